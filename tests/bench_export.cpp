@@ -0,0 +1,44 @@
+// Export benchmark: writes a synthetic -make project into a scratch directory, serially and
+// with the worker pool. Build and run from the repository root:
+//   g++ tests/bench_export.cpp -o /tmp/yori_bench -std=c++17 -O2 -pthread && /tmp/yori_bench [files] [threads]
+#define main yori_main
+#include "../yoric.cpp"
+#undef main
+
+int main(int argc, char* argv[]) {
+    size_t files = 2000;
+    unsigned threads = 0;
+    try {
+        if (argc >= 2) files = stoul(argv[1]);
+        if (argc >= 3) threads = (unsigned)stoul(argv[2]);
+    } catch (...) {
+        cout << "Usage: bench_export [files] [threads]" << endl;
+        return 1;
+    }
+
+    string code = "Generated project.\n";
+    for (size_t i = 0; i < files; i++) {
+        code += "EXPORT: \"src/mod" + to_string(i % 32) + "/file" + to_string(i) + ".cpp\"\n";
+        for (int l = 0; l < 200; l++) code += "int value_" + to_string(i) + "_" + to_string(l) + " = " + to_string(l) + "; // $${ fill }$$\n";
+        code += "EXPORT: END\n";
+    }
+    fs::path root = fs::temp_directory_path() / makeTempName("yori_bench", "");
+    cout << "[BENCH] " << files << " files, " << (code.size() / 1024) << " KB of EXPORT blocks in " << root.string() << endl;
+
+    auto run = [&](const string& label, const fs::path& dir, unsigned t) {
+        streambuf* saved = cout.rdbuf(nullptr); // Silence per-file progress
+        auto t0 = chrono::steady_clock::now();
+        processExports(code, dir, t);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+        cout.rdbuf(saved);
+        cout << "   " << left << setw(22) << label << fixed << setprecision(1) << ms << " ms" << endl;
+    };
+    unsigned workers = threads ? threads : max(1u, thread::hardware_concurrency());
+    run("serial", root / "serial", 1);
+    run("parallel, " + to_string(workers) + " workers", root / "parallel", workers);
+    run("parallel, unchanged", root / "parallel", workers);
+
+    std::error_code ec;
+    fs::remove_all(root, ec);
+    return 0;
+}
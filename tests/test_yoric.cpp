@@ -0,0 +1,171 @@
+// Unit checks for the offline helpers in yoric.cpp (no model, network or compiler needed).
+// Build and run from the repository root:
+//   g++ tests/test_yoric.cpp -o /tmp/yori_tests -std=c++17 -pthread && /tmp/yori_tests
+#define main yori_main
+#include "../yoric.cpp"
+#undef main
+
+int FAILURES = 0;
+
+void expect(bool ok, const string& what) {
+    cout << (ok ? "[PASS] " : "[FAIL] ") << what << endl;
+    if (!ok) FAILURES++;
+}
+
+// --- CANDIDATE CHECKS ---
+void testBalancedBrackets() {
+    expect(checkBalancedBrackets("struct Foo<'a> { s: &'a str }\n", "rust") == "", "rust lifetimes are not char literals");
+    expect(checkBalancedBrackets("fn f() -> char { let c = '{'; let d = '\\u{7D}'; c }\n", "rust") == "", "rust char literals with braces");
+    expect(checkBalancedBrackets("const s = 'a(b'.replace(/\\(/g, '');\n", "js") == "", "js regex literal with a bracket");
+    expect(checkBalancedBrackets("const r = x.split(/[)\\]]/); const h = a / b / (c);\n", "ts") == "", "ts regex class and division");
+    expect(checkBalancedBrackets("char c = '}'; int x = 1'000;\n", "cpp") == "", "cpp char literal and digit separator");
+    expect(checkBalancedBrackets("int main() { return 0;\n", "cpp") != "", "cpp unclosed brace is reported");
+    expect(checkBalancedBrackets("class A {\n  string p = Path.Combine(@\"C:\\dir\\\", \"x\");\n  string q = $@\"say \"\"{p}\"\" )\";\n}\n", "cs") == "",
+           "cs verbatim strings ending in a backslash");
+    expect(checkBalancedBrackets("val s = \"\"\"\n  a ( \"b\n  \"\"\"\"\nfun f() {}\n", "kt") == "", "kotlin raw string with a bracket and quotes");
+    expect(checkBalancedBrackets("class A {\n  String s = \"\"\"\n    he said \"hi\" ) \\\"\"\"\n    \"\"\";\n}\n", "java") == "", "java text block");
+    expect(checkBalancedBrackets("let s = \"\"\"\n  } \"\n  \"\"\"\nlet r = #\"a \"(\" b\"#\nfunc f() {}\n", "swift") == "", "swift multi-line and raw strings");
+    expect(checkBalancedBrackets("fn f() { let a = r#\"a \"quoted\" ( thing\"#; let p = r\"C:\\dir\\\"; let b = br\"[\"; }\n", "rust") == "",
+           "rust raw strings");
+    expect(checkBalancedBrackets("fn f() { let r#type = 1; }\n", "rust") == "", "rust raw identifier");
+}
+
+void testLanguageSignature() {
+    string go = "package main\n\nimport \"fmt\"\nimport \"os\"\n\nfunc main() {\n\tfmt.Println(len(os.Args))\n}\n";
+    expect(validateCandidate(go, LANG_DB.at("go"), false) == "", "go single-line imports are not python");
+    string goAlias = "package main\n\nimport f \"fmt\"\nimport (\n\t\"os\"\n)\n\nfunc main() {\n\tf.Println(os.Args)\n}\n";
+    expect(validateCandidate(goAlias, LANG_DB.at("go"), false) == "", "go aliased and grouped imports");
+    string py = "import os\nimport sys\n\ndef main():\n    print(os.getcwd())\n\nif __name__ == '__main__':\n    main()\n";
+    expect(validateCandidate(py, LANG_DB.at("go"), false) != "", "python answer to a go target is still caught");
+}
+
+// --- REPLY EXTRACTION ---
+// Body of each EXPORT in an extracted reply, keyed by file name
+map<string, string> exportedFiles(const string& reply) {
+    string code = extractCode(json{{"response", reply}}.dump(), LANG_DB.at("cpp"));
+    string remaining;
+    map<string, string> files;
+    for (const auto& e : splitExports(code, ".", remaining)) files[e.fname] = renderExport(code, e);
+    return files;
+}
+
+void testExtractExports() {
+    auto files = exportedFiles("Here is the project:\nEXPORT: \"main.cpp\"\n```cpp\nint main(){}\n```\nEXPORT: END\n"
+                               "EXPORT: \"CMakeLists.txt\"\n```cmake\nproject(app)\n```\nEXPORT: END\n");
+    expect(files.size() == 2, "per-file fenced make reply keeps every EXPORT");
+    expect(files["main.cpp"] == "int main(){}\n", "per-file fence lines are dropped");
+    expect(files["CMakeLists.txt"] == "project(app)\n", "second file body is intact");
+
+    files = exportedFiles("```\nEXPORT: \"a.h\"\n#pragma once\nEXPORT: END\nEXPORT: \"README.md\"\n# App\n```sh\nmake\n```\nEXPORT: END\n```\n");
+    expect(files["a.h"] == "#pragma once\n", "fence around the whole reply is dropped");
+    expect(files["README.md"] == "# App\n```sh\nmake\n```\n", "fences inside a file body are kept");
+
+    string single = extractCode(json{{"response", "Sure:\n```python\nprint(1)\n```\n```cpp\nint main(){}\n```\n"}}.dump(), LANG_DB.at("cpp"));
+    expect(single == "int main(){}\n", "single-file reply still selects the target language block");
+}
+
+void testResponseContext() {
+    string reply = "{\"model\":\"m\",\"response\":\"hi\",\"done\":true,\"context\":[1,2,300000],\"total_duration\":5}";
+    ResponseText r = parseResponseText(reply, true);
+    expect(r.found && r.text == "hi" && r.context == json::array({1, 2, 300000}), "ollama context is captured with the text");
+    expect(parseResponseText("{\"context\":[],\"response\":\"x\"}", true).context == json::array(), "empty context before the text");
+    expect(parseResponseText(reply).context.is_null(), "context is only read on request");
+    expect(parseResponseText("{\"response\":\"x\"}", true).context.is_null(), "missing context stays null");
+}
+
+void testExportKeepsFileMode() {
+    fs::path dir = fs::temp_directory_path() / makeTempName("yori_test_export", "");
+    fs::create_directories(dir / "scripts");
+    { ofstream(dir / "scripts/run.sh") << "echo old\n"; ofstream(dir / "real.txt") << "old\n"; }
+    fs::permissions(dir / "scripts/run.sh", fs::perms::owner_all | fs::perms::group_read | fs::perms::group_exec);
+    fs::create_symlink("real.txt", dir / "link.txt");
+    processExports("EXPORT: \"scripts/run.sh\"\necho new\nEXPORT: END\nEXPORT: \"link.txt\"\nnew\nEXPORT: END\n", dir, 2);
+
+    auto perms = fs::status(dir / "scripts/run.sh").permissions();
+    expect((perms & fs::perms::owner_exec) != fs::perms::none && (perms & fs::perms::group_exec) != fs::perms::none,
+           "re-exported script keeps its mode");
+    expect(fs::is_symlink(dir / "link.txt"), "symlinked export target stays a symlink");
+    ifstream in(dir / "real.txt");
+    string body((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    expect(body == "new\n", "export is written through the symlink");
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+}
+
+// --- MODEL CASCADE ---
+void testCascadeStatsConcurrent() {
+    fs::path saved = fs::current_path();
+    fs::path dir = fs::temp_directory_path() / makeTempName("yori_test_cascade", "");
+    fs::create_directories(dir);
+    fs::current_path(dir);
+    CASCADE = {ModelTier{"fast", "local", "m", 0, 0}};
+    vector<thread> workers;
+    for (int t = 0; t < 8; t++) workers.emplace_back([] { for (int i = 0; i < 25; i++) recordTierResult(0, 10.0, i % 2 == 0); });
+    for (auto& w : workers) w.join();
+    ifstream f(CACHE_DIR + "/cascade_stats.json");
+    json stats = json::parse(f, nullptr, false);
+    expect(stats.is_object() && stats["fast"].value("passes", 0) == 200 && stats["fast"].value("green", 0) == 104,
+           "concurrent cascade stats updates are not lost");
+    CASCADE.clear();
+    fs::current_path(saved);
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+}
+
+// --- CHUNKED EXPLAIN ---
+void testSkeletonDocstrings() {
+    string code = "def area(r):\n    # radius\n    return 3.14 * r * r\n\nclass Shape:\n    pass\n";
+    string documented = "def area(r):\n    \"\"\"Area of a circle.\n\n    r: radius\n    \"\"\"\n    # radius\n    return 3.14 * r * r\n\n"
+                        "class Shape:\n    r'Base shape.'  # doc\n    pass\n";
+    expect(codeSkeleton(code, "py") == codeSkeleton(documented, "py"), "python docstrings do not change the skeleton");
+    expect(codeSkeleton("x = 1\n", "py") != codeSkeleton("x = 2\n", "py"), "python code changes still do");
+    expect(codeSkeleton("msg = \"\"\"a\"\"\"\n", "py") != codeSkeleton("msg = \"\"\"b\"\"\"\n", "py"), "assigned strings are code");
+}
+
+// --- TREE SHAKING ---
+void testDefinedName() {
+    expect(definedName("setup_logging()") == "", "bare call defines nothing");
+    expect(definedName("app.listen(3000);") == "", "method call defines nothing");
+    expect(definedName("registerPlugin(new Foo());") == "", "call with a constructor argument defines nothing");
+    expect(definedName("atexit.register(cleanup)") == "", "registration call defines nothing");
+    expect(definedName("app.config = {}") == "", "attribute assignment defines nothing");
+    expect(definedName("static int helper(int x) {") == "helper", "c function definition");
+    expect(definedName("std::vector<int> Foo::load(const string& s)") == "load", "out-of-line member definition");
+    expect(definedName("Foo::Foo() : x(0) {") == "Foo", "out-of-line constructor");
+    expect(definedName("def index():") == "index", "python def");
+    expect(definedName("LIMIT = 10") == "LIMIT", "module constant");
+}
+
+void testShakeKeepsStatements() {
+    string unusedBody; // Large enough for shaking to pay off
+    for (int i = 0; i < 20; i++) unusedBody += "    x = x * " + to_string(i) + " + 1\n";
+    vector<string> inputs = {"import util\nprint(area(2))\n"
+                             "// >>>>>> START MODULE: util.py (.py) >>>>>>\n"
+                             "import logging\n\n"
+                             "def area(r):\n    return 3.14 * r * r\n\n"
+                             "def unused(x):\n" + unusedBody + "\n"
+                             "setup_logging()\n\n"
+                             "@app.route('/')\ndef index():\n    return 'ok'\n\n"
+                             "atexit.register(cleanup)\n"
+                             "// <<<<<< END MODULE: util.py <<<<<<\n"};
+    ShakeStats stats = treeShakeImports(inputs);
+    const string& out = inputs[0];
+    expect(stats.dropped == 1 && out.find("// [SHAKEN] def unused(x):") != string::npos, "unreferenced function is shaken");
+    expect(out.find("\nsetup_logging()\n") != string::npos, "top-level call is kept");
+    expect(out.find("@app.route('/')\ndef index():") != string::npos, "decorated function is kept");
+    expect(out.find("\natexit.register(cleanup)\n") != string::npos, "registration call is kept");
+}
+
+int main() {
+    testBalancedBrackets();
+    testLanguageSignature();
+    testExtractExports();
+    testResponseContext();
+    testExportKeepsFileMode();
+    testCascadeStatsConcurrent();
+    testSkeletonDocstrings();
+    testDefinedName();
+    testShakeKeepsStatements();
+    cout << (FAILURES ? to_string(FAILURES) + " check(s) failed." : "All checks passed.") << endl;
+    return FAILURES ? 1 : 0;
+}
@@ -19,6 +19,17 @@
 #include <functional>
 #include <set>
 #include <memory>
+#include <string_view>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cmath>
+#include <future>
+#include <deque>
+#include <random>
+#include <unordered_map>
+#include <cstring>
+#include <cerrno>
 
 #ifdef _WIN32
 #ifndef NOMINMAX
@@ -28,6 +39,14 @@
 #else
 #include <unistd.h>
 #include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
 #endif
 
 #ifndef _WIN32
@@ -50,40 +69,271 @@ string MODEL_ID = "";
 string API_URL = "";
 int MAX_RETRIES = 15;
 bool VERBOSE_MODE = false;
+size_t MAX_MEMORY_MB = 0; // [NEW] --max-memory guard (0 = unlimited)
+bool TREE_SHAKE = true;   // [NEW] -no-shake / "tree_shake": false
+bool RETRIEVAL_ENABLED = true;         // [NEW] "retrieval": false sends whole projects again
+size_t RETRIEVAL_BUDGET_TOKENS = 8000; // [NEW] "retrieval": { "budget_tokens": N, "top_k": K }
+size_t RETRIEVAL_TOP_K = 24;
 
 const string CURRENT_VERSION = "5.7.2";
 
+// [NEW] Cache System Constants
+const string CACHE_DIR = "yori_cache";
+const string LOCK_FILE = ".yori.lock";
+
 enum class GenMode { CODE, MODEL_3D, IMAGE };
 GenMode CURRENT_MODE = GenMode::CODE;
 
 // --- LOGGER SYSTEM ---
-ofstream logFile;
+// [NEW] Asynchronous logger. log() only moves the record into a lock-free MPSC ring (a
+// bounded Vyukov queue); a background thread formats it as a JSON line, writes it to
+// yori.log with buffered output and rotates the file by size. When the ring is full the
+// record is dropped and counted rather than blocking the caller.
+struct LogRecord {
+    chrono::system_clock::time_point time;
+    string level;
+    string message;
+    string correlation;
+    size_t thread = 0;
+};
 
-void initLogger() {
-    logFile.open("yori.log", ios::app); 
-    if (logFile.is_open()) {
-        auto t = time(nullptr);
-        auto tm = *localtime(&t);
-        logFile << "\n--- SESSION START (v" << CURRENT_VERSION << "): " << put_time(&tm, "%Y-%m-%d %H:%M:%S") << " ---\n";
+class LogRing {
+public:
+    static constexpr size_t CAPACITY = 4096; // Power of two
+
+    LogRing() : cells(new Cell[CAPACITY]) {
+        for (size_t i = 0; i < CAPACITY; i++) cells[i].seq.store(i, memory_order_relaxed);
+    }
+
+    // Any thread. Returns false when the ring is full.
+    bool push(LogRecord&& r) {
+        size_t pos = head.load(memory_order_relaxed);
+        while (true) {
+            Cell& c = cells[pos & (CAPACITY - 1)];
+            size_t seq = c.seq.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    c.record = move(r);
+                    c.seq.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer thread only
+    bool pop(LogRecord& r) {
+        Cell& c = cells[tail & (CAPACITY - 1)];
+        if ((intptr_t)c.seq.load(memory_order_acquire) - (intptr_t)(tail + 1) < 0) return false;
+        r = move(c.record);
+        c.seq.store(tail + CAPACITY, memory_order_release);
+        tail++;
+        return true;
+    }
+
+private:
+    struct Cell { atomic<size_t> seq; LogRecord record; };
+    unique_ptr<Cell[]> cells;
+    atomic<size_t> head{0};
+    size_t tail = 0;
+};
+
+int logLevelRank(const string& level) {
+    if (level == "DEBUG") return 0;
+    if (level == "INFO" || level == "CASCADE") return 1;
+    if (level == "WARN") return 2;
+    return 3; // ERROR, FAIL, API_FAIL, REJECT, ...
+}
+
+class AsyncLogger {
+public:
+    static constexpr size_t MAX_BYTES = 5 * 1024 * 1024; // Rotate past 5 MB
+    static constexpr int KEEP = 3;                       // yori.log.1 .. yori.log.3
+
+    void start(const string& filePath) {
+        path = filePath;
+        file.open(path, ios::app | ios::binary);
+        std::error_code ec;
+        written = fs::exists(path, ec) ? (size_t)fs::file_size(path, ec) : 0;
+        worker = thread([this]() { run(); });
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        stopping = true;
+        wake.notify_one();
+        worker.join();
+    }
+
+    // Full ring: INFO/DEBUG records are dropped; warnings and errors wait briefly for the writer
+    void push(LogRecord&& r, bool important) {
+        bool queued = ring.push(move(r));
+        for (int spin = 0; !queued && important && spin < 2000 && worker.joinable(); spin++) {
+            wake.notify_one();
+            this_thread::yield();
+            queued = ring.push(move(r));
+        }
+        if (!queued) { dropped++; return; }
+        wake.notify_one();
+    }
+
+private:
+    LogRing ring;
+    thread worker;
+    atomic<bool> stopping{false};
+    atomic<size_t> dropped{0};
+    mutex wakeMutex;
+    condition_variable wake;
+    ofstream file;
+    string path;
+    size_t written = 0;
+
+    void run() {
+        LogRecord r;
+        while (true) {
+            bool any = false;
+            while (ring.pop(r)) { write(r); any = true; }
+            if (size_t lost = dropped.exchange(0)) {
+                write({chrono::system_clock::now(), "WARN", to_string(lost) + " log records dropped (ring full)", "", 0});
+                any = true;
+            }
+            if (any) file.flush();
+            if (stopping) {
+                if (ring.pop(r)) { write(r); file.flush(); continue; }
+                break;
+            }
+            unique_lock<mutex> lock(wakeMutex);
+            wake.wait_for(lock, chrono::milliseconds(200));
+        }
+    }
+
+    void write(const LogRecord& r) {
+        if (!file.is_open()) return;
+        time_t t = chrono::system_clock::to_time_t(r.time);
+        tm local{};
+        #ifdef _WIN32
+        localtime_s(&local, &t);
+        #else
+        localtime_r(&t, &local);
+        #endif
+        char stamp[32];
+        size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &local);
+        int ms = (int)(chrono::duration_cast<chrono::milliseconds>(r.time.time_since_epoch()).count() % 1000);
+        snprintf(stamp + n, sizeof(stamp) - n, ".%03d", ms);
+
+        nlohmann::ordered_json line = {{"ts", stamp}, {"level", r.level}, {"msg", r.message}};
+        if (!r.correlation.empty()) line["req"] = r.correlation;
+        if (r.thread) line["tid"] = r.thread % 100000;
+        string text = line.dump(-1, ' ', false, json::error_handler_t::replace);
+        text += '\n';
+        file.write(text.data(), text.size());
+        written += text.size();
+        if (written > MAX_BYTES) rotate();
+    }
+
+    void rotate() {
+        file.close();
+        std::error_code ec;
+        fs::remove(path + "." + to_string(KEEP), ec);
+        for (int i = KEEP - 1; i >= 1; i--) fs::rename(path + "." + to_string(i), path + "." + to_string(i + 1), ec);
+        fs::rename(path, path + ".1", ec);
+        file.open(path, ios::app | ios::binary);
+        written = 0;
     }
+};
+
+AsyncLogger LOGGER;
+atomic<int> LOG_MIN_LEVEL{1}; // "log_level" in config.json
+thread_local string LOG_CORRELATION_ID;
+
+// Tags every record logged on this thread while in scope (e.g. one AI request)
+struct LogScope {
+    string previous;
+    explicit LogScope(const string& id) : previous(LOG_CORRELATION_ID) { LOG_CORRELATION_ID = id; }
+    ~LogScope() { LOG_CORRELATION_ID = previous; }
+};
+
+void initLogger() {
+    LOGGER.start("yori.log");
+    atexit([]() { LOGGER.stop(); });
+    LOGGER.push({chrono::system_clock::now(), "INFO", "SESSION START (v" + CURRENT_VERSION + ")", "", 0}, true);
 }
 
+mutex LOG_MUTEX; // Serializes verbose console echo only
+
 void log(string level, string message) {
-    if (logFile.is_open()) {
-        auto t = time(nullptr);
-        auto tm = *localtime(&t);
-        logFile << "[" << put_time(&tm, "%H:%M:%S") << "] [" << level << "] " << message << endl;
+    if (VERBOSE_MODE) {
+        lock_guard<mutex> lock(LOG_MUTEX);
+        cout << "   [" << level << "] " << message << endl;
     }
-    if (VERBOSE_MODE) cout << "   [" << level << "] " << message << endl;
+    int rank = logLevelRank(level);
+    if (rank < LOG_MIN_LEVEL.load(memory_order_relaxed)) return;
+    LOGGER.push({chrono::system_clock::now(), move(level), move(message), LOG_CORRELATION_ID,
+                 hash<thread::id>{}(this_thread::get_id())}, rank >= 2);
 }
 
 // --- UTILS DECLARATION ---
 struct CmdResult { string output; int exitCode; };
 
-CmdResult execCmd(string cmd) {
+#ifndef _WIN32
+// [FIX] Close-on-exec pipe, so concurrent popen/fork children never inherit the ends (an
+// inherited write end delays EOF until that unrelated child exits)
+int cloexecPipe(int fds[2]) {
+    #ifdef __linux__
+    return pipe2(fds, O_CLOEXEC);
+    #else
+    if (pipe(fds) != 0) return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+    #endif
+}
+#endif
+
+CmdResult execCmd(string cmd, const atomic<bool>* cancel = nullptr) {
     array<char, 128> buffer; string result; 
     string full_cmd = cmd + " 2>&1"; 
     
+    #ifndef _WIN32
+    // [NEW] Cancellable variant: run in its own process group so the whole tree can be killed
+    if (cancel) {
+        int fds[2];
+        if (cloexecPipe(fds) != 0) return {"EXEC_FAIL", -1};
+        pid_t pid = fork();
+        if (pid < 0) { close(fds[0]); close(fds[1]); return {"EXEC_FAIL", -1}; }
+        if (pid == 0) {
+            setpgid(0, 0);
+            dup2(fds[1], 1); // The duplicate does not inherit close-on-exec
+            close(fds[0]); close(fds[1]);
+            execl("/bin/sh", "sh", "-c", full_cmd.c_str(), (char*)nullptr);
+            _exit(127);
+        }
+        setpgid(pid, pid);
+        close(fds[1]);
+        bool cancelled = false;
+        char chunk[4096];
+        while (true) {
+            if (cancel->load()) { kill(-pid, SIGKILL); cancelled = true; break; }
+            pollfd p{fds[0], POLLIN, 0};
+            if (poll(&p, 1, 100) <= 0) continue;
+            ssize_t n = read(fds[0], chunk, sizeof(chunk));
+            if (n <= 0) break;
+            result.append(chunk, n);
+        }
+        close(fds[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (cancelled) return {"CANCELLED", -1};
+        return {result, status}; // Same wait status as _pclose below
+
+    }
+    #endif
+
     FILE* pipe = _popen(full_cmd.c_str(), "r");
     if (!pipe) return {"EXEC_FAIL", -1};
     while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) result += buffer.data();
@@ -127,6 +377,30 @@ string formatDuration(long long seconds) {
     return to_string(min) + "m " + to_string(sec) + "s";
 }
 
+// [NEW] Unique temp names so concurrent requests never share request/response files
+string makeTempName(const string& prefix, const string& ext) {
+    static atomic<unsigned> counter{0};
+    #ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+    #else
+    unsigned long pid = (unsigned long)getpid();
+    #endif
+    return prefix + "_" + to_string(pid) + "_" + to_string(counter++) + ext;
+}
+
+// [NEW] Runs fn(0..n-1) on up to `threads` workers (0 = one per core); a single worker runs inline
+void parallelFor(size_t n, const function<void(size_t)>& fn, unsigned threads = 0) {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    threads = (unsigned)min<size_t>(threads, n);
+    if (threads <= 1) { for (size_t i = 0; i < n; i++) fn(i); return; }
+    atomic<size_t> next{0};
+    vector<thread> pool;
+    for (unsigned t = 0; t < threads; t++) {
+        pool.emplace_back([&]() { for (size_t i = next++; i < n; i = next++) fn(i); });
+    }
+    for (auto& th : pool) th.join();
+}
+
 // --- LANGUAGE SYSTEM ---
 struct LangProfile {
     string id; string name; string extension;  
@@ -195,10 +469,538 @@ map<string, LangProfile> IMAGE_DB = {
 
 LangProfile CURRENT_LANG; 
 
+// [NEW] Optional persistent compilers for JVM/.NET profiles, so verification passes do not
+// pay JVM/CLR startup every time. "worker" keeps a resident JVM fed over stdin (javax.tools
+// for javac, K2JVMCompiler for kotlinc); "command" swaps the build command for a
+// server-backed one and runs `stop` when Yori exits.
+struct CompileServerSpec {
+    string mode;      // "worker" or "command"
+    string buildCmd;  // command mode: replaces LangProfile::buildCmd
+    string start;     // command mode: run once before the first build (optional)
+    string stop;      // command mode: run at exit (optional)
+};
+
+map<string, CompileServerSpec> COMPILE_SERVER_DEFAULTS = {
+    {"java",   {"worker", "", "", ""}},
+    {"kt",     {"worker", "", "", ""}},
+    {"scala",  {"command", "fsc", "", "fsc -shutdown"}},
+    {"cs",     {"command", "dotnet build -p:UseSharedCompilation=true -nodeReuse:true", "", "dotnet build-server shutdown"}},
+    {"fs",     {"command", "dotnet build -p:UseSharedCompilation=true -nodeReuse:true", "", "dotnet build-server shutdown"}},
+    {"vb",     {"command", "dotnet build -p:UseSharedCompilation=true -nodeReuse:true", "", "dotnet build-server shutdown"}}
+};
+
+map<string, CompileServerSpec> COMPILE_SERVERS; // Enabled servers by language id
+
+// --- RATE LIMITING ---
+// [NEW] Token bucket + concurrency limiter shared by every caller of one provider
+// (endpoint + key). It paces requests proactively and learns from 429s and
+// rate-limit headers (AIMD), so parallel callers never stampede and then sleep.
+class RateLimiter {
+public:
+    RateLimiter(double requestsPerMinute, int maxConcurrent)
+        : ceiling(requestsPerMinute / 60.0), rate(requestsPerMinute / 60.0),
+          tokens(max(1.0, requestsPerMinute / 60.0)), maxConcurrent(max(1, maxConcurrent)),
+          last(chrono::steady_clock::now()) {}
+
+    // Blocks until both a token and a concurrency slot are available
+    void acquire() {
+        unique_lock<mutex> lock(m);
+        while (true) {
+            auto now = chrono::steady_clock::now();
+            refill(now);
+            bool haveToken = (rate <= 0 || tokens >= 1.0);
+            if (now >= pausedUntil && haveToken && inFlight < maxConcurrent) {
+                if (rate > 0) tokens -= 1.0;
+                inFlight++;
+                return;
+            }
+            auto wakeAt = max(pausedUntil, now + chrono::milliseconds(inFlight >= maxConcurrent ? 1000 : 0));
+            if (!haveToken) wakeAt = max(wakeAt, now + chrono::milliseconds((long long)((1.0 - tokens) / rate * 1000) + 1));
+            cv.wait_until(lock, wakeAt);
+        }
+    }
+
+    void release() {
+        { lock_guard<mutex> lock(m); inFlight--; }
+        cv.notify_all();
+    }
+
+    // Provider pushed back: halve the rate and pause for as long as it asked (or exponentially)
+    void onThrottle(double waitSec) {
+        lock_guard<mutex> lock(m);
+        throttles++;
+        rate = (rate <= 0) ? 1.0 : max(1.0 / 60.0, rate * 0.5);
+        tokens = 0;
+        if (waitSec <= 0) waitSec = min(60.0, pow(2.0, throttles));
+        pausedUntil = max(pausedUntil, chrono::steady_clock::now() + chrono::milliseconds((long long)(waitSec * 1000)));
+    }
+
+    // Successful request: creep back towards the configured ceiling; obey exhausted quotas
+    void onSuccess(int remaining, double resetSec) {
+        lock_guard<mutex> lock(m);
+        throttles = 0;
+        if (rate > 0) {
+            rate += 1.0 / 60.0;
+            if (ceiling > 0) rate = min(rate, ceiling);
+            else if (rate >= 10.0) rate = 0; // Learned limit no longer binding: back to unlimited
+        }
+        if (remaining == 0 && resetSec > 0) {
+            pausedUntil = max(pausedUntil, chrono::steady_clock::now() + chrono::milliseconds((long long)(resetSec * 1000)));
+        }
+    }
+
+    chrono::steady_clock::time_point readyAt() {
+        lock_guard<mutex> lock(m);
+        return pausedUntil;
+    }
+
+    int concurrency() const { return maxConcurrent; }
+
+private:
+    void refill(chrono::steady_clock::time_point now) {
+        if (rate > 0) tokens = min(max(1.0, rate), tokens + chrono::duration<double>(now - last).count() * rate);
+        last = now;
+    }
+
+    mutex m;
+    condition_variable cv;
+    double ceiling;  // Configured requests/second (0 = unlimited)
+    double rate;     // Current requests/second (0 = unlimited)
+    double tokens;
+    int maxConcurrent;
+    int inFlight = 0;
+    int throttles = 0;
+    chrono::steady_clock::time_point last;
+    chrono::steady_clock::time_point pausedUntil;
+};
+
+// Parses provider durations such as "37s", "6m0s", "2m59.56s", "120ms" or plain seconds
+double parseDurationSec(string v) {
+    v.erase(0, v.find_first_not_of(" \t\""));
+    double total = 0;
+    size_t i = 0;
+    bool any = false;
+    while (i < v.length() && (isdigit((unsigned char)v[i]) || v[i] == '.')) {
+        size_t j = i;
+        while (j < v.length() && (isdigit((unsigned char)v[j]) || v[j] == '.')) j++;
+        double num = 0;
+        try { num = stod(v.substr(i, j - i)); } catch (...) { return total; }
+        any = true;
+        if (v.compare(j, 2, "ms") == 0) { total += num / 1000.0; j += 2; }
+        else if (j < v.length() && v[j] == 'h') { total += num * 3600; j++; }
+        else if (j < v.length() && v[j] == 'm') { total += num * 60; j++; }
+        else if (j < v.length() && v[j] == 's') { total += num; j++; }
+        else { total += num; }
+        i = j;
+    }
+    return any ? total : 0;
+}
+
+string headerValue(const string& headers, const string& name) {
+    stringstream ss(headers);
+    string line;
+    string prefix = name + ":";
+    while (getline(ss, line)) {
+        if (line.length() < prefix.length()) continue;
+        string head = line.substr(0, prefix.length());
+        transform(head.begin(), head.end(), head.begin(), ::tolower);
+        if (head == prefix) {
+            string v = line.substr(prefix.length());
+            v.erase(0, v.find_first_not_of(" \t"));
+            v.erase(v.find_last_not_of(" \t\r") + 1);
+            return v;
+        }
+    }
+    return "";
+}
+
+// --- MACHINE SCHEDULER ---
+// [NEW] Coordinates concurrent yori processes on one machine through lock files in
+// ~/.yori/slots. A slot is an exclusively locked file, so a crashed or killed process frees
+// its slots by itself. Waiters hold a locked ticket named after their priority and arrival
+// time; the best-ranked live tickets take free slots first, and every SCHED_AGING_SEC of
+// waiting raises a ticket one priority level so batch work is never starved.
+enum SchedPriority { PRIO_BATCH = 0, PRIO_NORMAL = 1, PRIO_INTERACTIVE = 2 };
+bool SCHED_ENABLED = true;          // "scheduler": false in config.json turns it off
+int SCHED_PRIORITY = PRIO_NORMAL;   // Set per command in main; --priority overrides
+int SCHED_COMPILE_SLOTS = 0;        // 0 = one per core
+int SCHED_AGING_SEC = 30;
+
+fs::path yoriHomeDir() {
+    const char* home = getenv("HOME");
+    #ifdef _WIN32
+    if (!home) home = getenv("USERPROFILE");
+    #endif
+    return home ? fs::path(home) / ".yori" : fs::temp_directory_path() / "yori";
+}
+
+int parsePriority(const string& name) {
+    if (name == "batch" || name == "low") return PRIO_BATCH;
+    if (name == "interactive" || name == "high") return PRIO_INTERACTIVE;
+    if (name == "normal") return PRIO_NORMAL;
+    return -1;
+}
+
+// Exclusive, non-blocking lock on a file. Not inherited by child processes; released on
+// destruction or when the process dies.
+class FileLock {
+public:
+    FileLock() = default;
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+    ~FileLock() { unlock(); }
+
+    bool tryLock(const fs::path& p) {
+        unlock();
+        #ifdef _WIN32
+        HANDLE h = CreateFileW(p.wstring().c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h == INVALID_HANDLE_VALUE) return false;
+        handle = h;
+        #else
+        int fd = open(p.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) { close(fd); return false; }
+        handle = fd;
+        #endif
+        path = p;
+        return true;
+    }
+
+    bool locked() const {
+        #ifdef _WIN32
+        return handle != INVALID_HANDLE_VALUE;
+        #else
+        return handle >= 0;
+        #endif
+    }
+
+    void unlock() {
+        if (!locked()) return;
+        #ifdef _WIN32
+        CloseHandle(handle);
+        handle = INVALID_HANDLE_VALUE;
+        #else
+        close(handle);
+        handle = -1;
+        #endif
+        path.clear();
+    }
+
+    fs::path path;
+
+private:
+    #ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    #else
+    int handle = -1;
+    #endif
+};
+
+struct SchedTicket {
+    int priority;
+    long long arrival; // Nanoseconds since epoch
+    string name;
+};
+
+// "<priority>-<arrival>-<pid>-<seq>.ticket"
+bool parseTicket(const string& name, SchedTicket& t) {
+    if (name.size() < 8 || name.compare(name.size() - 7, 7, ".ticket") != 0) return false;
+    char* end = nullptr;
+    t.priority = (int)strtol(name.c_str(), &end, 10);
+    if (*end != '-') return false;
+    t.arrival = strtoll(end + 1, &end, 10);
+    if (*end != '-') return false;
+    t.name = name;
+    return true;
+}
+
+// Blocks until one of `slots` slots of `pool` is free and this caller's ticket is among the
+// first in line. Returns false (without a slot) when `cancel` is set while waiting.
+bool acquireSlot(const string& pool, int slots, const atomic<bool>* cancel, const string& what, FileLock& slot) {
+    if (!SCHED_ENABLED || slots <= 0) return true;
+    static atomic<unsigned> seq{0};
+    error_code ec;
+    fs::path dir = yoriHomeDir() / "slots";
+    fs::path waitDir = dir / (pool + ".wait");
+    fs::create_directories(waitDir, ec);
+    if (ec) return true; // No shared directory: run uncoordinated rather than not at all
+
+    auto nowNs = []() { return (long long)chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count(); };
+    SchedTicket mine{SCHED_PRIORITY, nowNs(), ""};
+    #ifdef _WIN32
+    long long pid = (long long)GetCurrentProcessId();
+    #else
+    long long pid = (long long)getpid();
+    #endif
+    mine.name = to_string(mine.priority) + "-" + to_string(mine.arrival) + "-" + to_string(pid) + "-" + to_string(seq++) + ".ticket";
+
+    // Lock under a temporary name first so nobody sees the ticket unlocked and sweeps it
+    FileLock ticket;
+    fs::path tmp = waitDir / ("." + mine.name);
+    if (ticket.tryLock(tmp)) {
+        fs::rename(tmp, waitDir / mine.name, ec);
+        if (ec) { ticket.unlock(); fs::remove(tmp, ec); }
+    }
+    auto dropTicket = [&]() {
+        if (!ticket.locked()) return;
+        fs::remove(waitDir / mine.name, ec);
+        ticket.unlock();
+    };
+
+    auto effective = [&](const SchedTicket& t, long long now) {
+        long long waited = (now - t.arrival) / 1000000000LL;
+        return t.priority + (SCHED_AGING_SEC > 0 ? (int)(waited / SCHED_AGING_SEC) : 0);
+    };
+
+    auto start = chrono::steady_clock::now();
+    bool announced = false;
+    while (true) {
+        // Rank among live waiters; tickets whose owner died are unlocked and get swept
+        long long now = nowNs();
+        int myPrio = effective(mine, now);
+        int ahead = 0;
+        for (auto it = fs::directory_iterator(waitDir, ec); !ec && it != fs::directory_iterator(); it.increment(ec)) {
+            string name = it->path().filename().string();
+            SchedTicket t;
+            if (name == mine.name || !parseTicket(name, t)) {
+                if (name[0] == '.' && now - strtoll(name.c_str() + name.find('-') + 1, nullptr, 10) > 60000000000LL) fs::remove(it->path(), ec);
+                continue;
+            }
+            FileLock probe;
+            if (probe.tryLock(it->path())) { fs::remove(it->path(), ec); continue; }
+            int prio = effective(t, now);
+            if (prio > myPrio || (prio == myPrio && t.arrival < mine.arrival)) ahead++;
+        }
+        ec.clear();
+
+        if (ahead < slots) {
+            for (int i = 0; i < slots; i++) {
+                if (slot.tryLock(dir / (pool + "." + to_string(i) + ".lock"))) {
+                    dropTicket();
+                    if (announced) log("INFO", "Got " + what + " slot after " + to_string(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count()) + " ms");
+                    return true;
+                }
+            }
+        }
+        if (cancel && cancel->load()) { dropTicket(); return false; }
+        if (!announced && chrono::steady_clock::now() - start > chrono::seconds(1)) {
+            announced = true;
+            cout << "   [SCHED] Waiting for a " << what << " slot (" << ahead << " ahead)..." << endl;
+        }
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+}
+
+// One compile slot per compiler invocation; `compileSlots` defaults to the core count
+bool acquireCompileSlot(FileLock& slot, const atomic<bool>* cancel = nullptr) {
+    int slots = SCHED_COMPILE_SLOTS > 0 ? SCHED_COMPILE_SLOTS : (int)max(1u, thread::hardware_concurrency());
+    return acquireSlot("compile", slots, cancel, "compile", slot);
+}
+
+// Default priority of an invocation: single-file fix/explain/diff/sos are interactive,
+// directory batches, -series and -make builds are batch work
+int defaultPriority(int argc, char* argv[]) {
+    string cmd = argv[1];
+    error_code ec;
+    if (cmd == "fix" || cmd == "explain") return (argc > 2 && fs::is_directory(argv[2], ec)) ? PRIO_BATCH : PRIO_INTERACTIVE;
+    if (cmd == "diff" || cmd == "sos") return PRIO_INTERACTIVE;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-series" || arg == "-make") return PRIO_BATCH;
+    }
+    return PRIO_NORMAL;
+}
+
+// --- BACKEND POOL ---
+// [NEW] Every profile resolves to one or more backends (endpoints / API keys).
+// callAI routes each request to the healthiest one and fails over on errors.
+struct Backend {
+    string name;
+    string protocol;
+    string url;
+    string apiKey;
+    string modelId;
+    int outstanding = 0;         // Requests currently in flight
+    double latencyMs = 0;        // EWMA of successful request latency (0 = unknown)
+    int failures = 0;            // Consecutive failures, opens the circuit
+    chrono::steady_clock::time_point blockedUntil; // Circuit open or Retry-After window
+    chrono::steady_clock::time_point lastUsed;
+    shared_ptr<RateLimiter> limiter;
+    string group;                // Profile the backend belongs to ('local', 'cloud')
+    json keepAlive;              // Ollama: how long the model stays loaded ("30m", -1, ...)
+    json options;                // Ollama: num_ctx, num_predict, temperature, seed, ...
+    bool session = true;         // Ollama: retries continue the previous reply's context
+};
+
+vector<Backend> BACKENDS;
+
+// [NEW] Ollama conversation state across retry passes: the token context returned with the
+// last reply (prompt + answer) and the backend/model it belongs to. A follow-up request sends
+// that context with only the new text, so the server does not prefill the whole prompt again.
+struct AISession {
+    json context;   // "context" array of the last /api/generate reply (null = none yet)
+    string backend; // Backend name the context was built on; requests are pinned to it
+    string model;
+};
+const size_t OLLAMA_DEFAULT_NUM_CTX = 2048; // Context window assumed when options.num_ctx is unset
+
+// Per-request routing overrides (model cascade tiers)
+struct CallOptions {
+    string profile; // Only use backends of this profile (empty = primary profile)
+    string model;   // Override the backend's model id
+    const atomic<bool>* cancel = nullptr; // Abort the request (kills the transfer) when set
+    AISession* session = nullptr; // [NEW] Continue / record an Ollama session
+    string followUp = "";         // Sent instead of the prompt while the session is usable
+};
+
+struct ModelTier {
+    string name;
+    string profile;
+    string model;
+    int maxPasses = 0;          // Failed passes before escalating (0 = stay on this tier)
+    size_t maxPromptChars = 0;  // Prompts larger than this skip the tier (0 = no limit)
+};
+vector<ModelTier> CASCADE;
+string ROUTING = "least_outstanding"; // 'least_outstanding', 'latency'
+mutex BACKEND_MUTEX;
+const int CIRCUIT_THRESHOLD = 3;
+const int CIRCUIT_COOLDOWN_SEC = 30;
+
+string defaultApiUrl(const string& protocol, const string& model, const string& mode) {
+    if (protocol == "google") return "https://generativelanguage.googleapis.com/v1beta/models/" + model + ":generateContent";
+    if (protocol == "openai") return "https://api.openai.com/v1/chat/completions";
+    if (mode == "local") return "http://localhost:11434/api/generate";
+    return "";
+}
+
+// Picks the backend for the next request. Returns -1 and the wait time when every backend is blocked.
+int acquireBackend(chrono::milliseconds& wait, const string& group, const string& prefer = "") {
+    lock_guard<mutex> lock(BACKEND_MUTEX);
+    auto now = chrono::steady_clock::now();
+    int best = -1;
+    string wanted = group.empty() ? PROVIDER : group;
+    bool anyInGroup = false;
+    for (const auto& b : BACKENDS) if (b.group == wanted) anyInGroup = true;
+    for (int i = 0; i < (int)BACKENDS.size(); i++) {
+        const Backend& b = BACKENDS[i];
+        if (anyInGroup && b.group != wanted) continue;
+        if (b.blockedUntil > now || (b.limiter && b.limiter->readyAt() > now)) continue;
+        if (!prefer.empty() && b.name == prefer) { best = i; break; } // Session pinned to this backend
+        if (best < 0) { best = i; continue; }
+        const Backend& c = BACKENDS[best];
+        bool better;
+        if (ROUTING == "latency") {
+            better = (b.latencyMs != c.latencyMs) ? b.latencyMs < c.latencyMs
+                   : (b.outstanding != c.outstanding) ? b.outstanding < c.outstanding : b.lastUsed < c.lastUsed;
+        } else {
+            better = (b.outstanding != c.outstanding) ? b.outstanding < c.outstanding
+                   : (b.lastUsed != c.lastUsed) ? b.lastUsed < c.lastUsed : b.latencyMs < c.latencyMs;
+        }
+        if (better) best = i;
+    }
+    if (best < 0) {
+        auto readyAt = [](const Backend& b) { return b.limiter ? max(b.blockedUntil, b.limiter->readyAt()) : b.blockedUntil; };
+        auto earliest = chrono::steady_clock::time_point::max();
+        for (const auto& b : BACKENDS) if (!anyInGroup || b.group == wanted) earliest = min(earliest, readyAt(b));
+        wait = chrono::duration_cast<chrono::milliseconds>(earliest - now);
+        return -1;
+    }
+    BACKENDS[best].outstanding++;
+    BACKENDS[best].lastUsed = now;
+    return best;
+}
+
+void releaseBackend(int idx, bool ok, double latencyMs, int retryAfterSec) {
+    lock_guard<mutex> lock(BACKEND_MUTEX);
+    Backend& b = BACKENDS[idx];
+    b.outstanding--;
+    auto now = chrono::steady_clock::now();
+    if (ok) {
+        b.failures = 0;
+        b.latencyMs = (b.latencyMs == 0) ? latencyMs : 0.7 * b.latencyMs + 0.3 * latencyMs;
+        return;
+    }
+    b.failures++;
+    if (retryAfterSec > 0) {
+        b.blockedUntil = now + chrono::seconds(retryAfterSec);
+        log("WARN", "Backend " + b.name + " asked to retry after " + to_string(retryAfterSec) + "s.");
+    } else if (b.failures >= CIRCUIT_THRESHOLD) {
+        b.blockedUntil = now + chrono::seconds(CIRCUIT_COOLDOWN_SEC);
+        log("WARN", "Circuit open for backend " + b.name + " (" + to_string(b.failures) + " consecutive failures).");
+    }
+}
+
 // --- CONFIG & TOOLCHAIN OVERRIDES ---
+// [NEW] Builds the backends of one profile. "pool" entries inherit unset fields from the
+// profile, "api_keys" spreads load across several keys of the same endpoint.
+void addProfileBackends(const json& profile, const string& mode, map<string, shared_ptr<RateLimiter>>& limiters) {
+    string protocol = profile.value("protocol", mode == "cloud" ? "google" : "ollama");
+    string model = profile.value("model_id", "gemini-pro");
+    string url = profile.contains("api_url") ? profile["api_url"].get<string>() : defaultApiUrl(protocol, model, mode);
+    string key = (mode == "cloud") ? profile.value("api_key", "") : "";
+    size_t first = BACKENDS.size();
+
+    if (profile.contains("pool") && profile["pool"].is_array()) {
+        for (auto& entry : profile["pool"]) {
+            Backend b;
+            b.protocol = entry.value("protocol", protocol);
+            b.modelId = entry.value("model_id", model);
+            b.url = entry.value("api_url", entry.contains("protocol") ? defaultApiUrl(b.protocol, b.modelId, mode) : url);
+            b.apiKey = entry.value("api_key", key);
+            b.name = entry.value("name", mode + "#" + to_string(BACKENDS.size() - first + 1));
+            b.group = mode;
+            BACKENDS.push_back(b);
+        }
+    }
+    if (profile.contains("api_keys") && profile["api_keys"].is_array()) {
+        for (auto& k : profile["api_keys"]) {
+            Backend b;
+            b.name = mode + "#key" + to_string(BACKENDS.size() - first + 1);
+            b.protocol = protocol;
+            b.url = url;
+            b.apiKey = k.get<string>();
+            b.modelId = model;
+            b.group = mode;
+            BACKENDS.push_back(b);
+        }
+    }
+    if (BACKENDS.size() == first) {
+        Backend b;
+        b.name = mode;
+        b.protocol = protocol;
+        b.url = url;
+        b.apiKey = key;
+        b.modelId = model;
+        b.group = mode;
+        BACKENDS.push_back(b);
+    }
+
+    // [NEW] Ollama model residency and sampling options, overridable per pool entry
+    for (size_t i = first; i < BACKENDS.size(); i++) {
+        const json* entry = nullptr;
+        if (profile.contains("pool") && i - first < profile["pool"].size()) entry = &profile["pool"][i - first];
+        BACKENDS[i].keepAlive = (entry && entry->contains("keep_alive")) ? (*entry)["keep_alive"] : profile.value("keep_alive", json());
+        BACKENDS[i].options = (entry && entry->contains("options")) ? (*entry)["options"] : profile.value("options", json());
+        BACKENDS[i].session = (entry && entry->contains("session")) ? (*entry)["session"].get<bool>() : profile.value("session", true);
+    }
+
+    // [NEW] "rate_limit": { "rpm": 60, "max_concurrent": 4 } (rpm 0 = learn from 429s only).
+    // One limiter per provider: backends sharing endpoint and key share their budget.
+    json limits = profile.value("rate_limit", json::object());
+    double rpm = limits.value("rpm", mode == "local" ? 0.0 : 60.0);
+    int maxConcurrent = limits.value("max_concurrent", mode == "local" ? 1 : 4);
+    for (size_t i = first; i < BACKENDS.size(); i++) {
+        auto& shared = limiters[BACKENDS[i].url + "|" + BACKENDS[i].apiKey];
+        if (!shared) shared = make_shared<RateLimiter>(rpm, maxConcurrent);
+        BACKENDS[i].limiter = shared;
+    }
+}
+
 bool loadConfig(string mode) {
+    PROVIDER = mode;
     string configPath = "config.json";
     ifstream f(configPath);
+    map<string, shared_ptr<RateLimiter>> limiters;
     if (!f.is_open()) {
         if(mode == "local") {
             API_URL = "http://localhost:11434/api/generate";
@@ -206,11 +1008,15 @@ bool loadConfig(string mode) {
         } else {
             PROTOCOL = "google"; 
         }
+        BACKENDS.clear();
+        addProfileBackends(json{{"protocol", PROTOCOL}, {"api_url", API_URL}, {"model_id", MODEL_ID}}, mode, limiters);
         return true; 
     }
 
     try {
         json j = json::parse(f);
+        BACKENDS.clear();
+        CASCADE.clear();
         if (j.contains("max_retries")) {
             MAX_RETRIES = j["max_retries"];
         }
@@ -226,18 +1032,87 @@ bool loadConfig(string mode) {
             if (profile.contains("api_url")) {
                 API_URL = profile["api_url"];
             } else {
-                if (PROTOCOL == "google") API_URL = "https://generativelanguage.googleapis.com/v1beta/models/" + MODEL_ID + ":generateContent";
-                else if (PROTOCOL == "openai") API_URL = "https://api.openai.com/v1/chat/completions";
-                else if (mode == "local") API_URL = "http://localhost:11434/api/generate";
+                API_URL = defaultApiUrl(PROTOCOL, MODEL_ID, mode);
             }
 
             if (mode == "cloud") API_KEY = profile.value("api_key", "");
+            ROUTING = profile.value("routing", ROUTING);
+            addProfileBackends(profile, mode, limiters);
+        } else {
+            addProfileBackends(json{{"protocol", PROTOCOL}, {"api_url", API_URL}, {"model_id", MODEL_ID}}, mode, limiters);
+        }
+        if (BACKENDS.size() > 1) log("INFO", "Backend pool: " + to_string(BACKENDS.size()) + " backends, routing by " + ROUTING);
+
+        // [NEW] Model cascade: cheap tiers first, escalate on persistent failures or big prompts
+        if (j.contains("cascade") && j["cascade"].is_array()) {
+            set<string> loadedProfiles = {mode};
+            for (auto& t : j["cascade"]) {
+                ModelTier tier;
+                tier.profile = t.value("profile", mode);
+                tier.model = t.value("model_id", "");
+                tier.maxPasses = t.value("max_passes", 0);
+                tier.maxPromptChars = t.value("max_prompt_chars", (size_t)0);
+                if (!loadedProfiles.count(tier.profile)) {
+                    if (!j.contains(tier.profile)) { cerr << "[ERROR] Cascade tier uses unknown profile '" << tier.profile << "'." << endl; return false; }
+                    addProfileBackends(j[tier.profile], tier.profile, limiters);
+                    loadedProfiles.insert(tier.profile);
+                }
+                tier.name = tier.profile + ":" + (tier.model.empty() ? j[tier.profile].value("model_id", MODEL_ID) : tier.model);
+                CASCADE.push_back(tier);
+            }
+            log("INFO", "Model cascade: " + to_string(CASCADE.size()) + " tiers.");
+        }
+
+        // [NEW] Minimum level written to yori.log: DEBUG, INFO (default), WARN or ERROR
+        if (j.contains("log_level")) LOG_MIN_LEVEL = logLevelRank(j["log_level"].get<string>());
+
+        // [NEW] Retrieval of project context in -series / -make repair prompts
+        if (j.contains("retrieval")) {
+            const json& rt = j["retrieval"];
+            if (rt.is_boolean()) RETRIEVAL_ENABLED = rt.get<bool>();
+            else if (rt.is_object()) {
+                RETRIEVAL_ENABLED = rt.value("enabled", true);
+                RETRIEVAL_BUDGET_TOKENS = rt.value("budget_tokens", RETRIEVAL_BUDGET_TOKENS);
+                RETRIEVAL_TOP_K = rt.value("top_k", RETRIEVAL_TOP_K);
+            }
+        }
+
+        // [NEW] Tree shaking of IMPORTed modules is on by default; config can only turn it off
+        if (j.contains("tree_shake") && !j["tree_shake"].get<bool>()) TREE_SHAKE = false;
+
+        // [NEW] Machine-wide scheduler: false, or { "compile_slots": N, "aging_seconds": S }
+        if (j.contains("scheduler")) {
+            const json& sc = j["scheduler"];
+            if (sc.is_boolean()) SCHED_ENABLED = sc.get<bool>();
+            else if (sc.is_object()) {
+                SCHED_ENABLED = sc.value("enabled", true);
+                SCHED_COMPILE_SLOTS = sc.value("compile_slots", 0);
+                SCHED_AGING_SEC = sc.value("aging_seconds", 30);
+            }
         }
+
+        // [NEW] "compile_server": true enables the built-in servers for every supported profile
+        if (j.value("compile_server", false)) COMPILE_SERVERS = COMPILE_SERVER_DEFAULTS;
+
         if (j.contains("toolchains")) {
             for (auto& [key, val] : j["toolchains"].items()) {
                 if (LANG_DB.count(key)) {
                     if (val.contains("build_cmd")) LANG_DB[key].buildCmd = val["build_cmd"];
                     if (val.contains("version_cmd")) LANG_DB[key].versionCmd = val["version_cmd"];
+                    if (val.contains("compile_server")) {
+                        const json& cs = val["compile_server"];
+                        if (cs.is_boolean()) {
+                            if (!cs.get<bool>()) COMPILE_SERVERS.erase(key);
+                            else if (COMPILE_SERVER_DEFAULTS.count(key)) COMPILE_SERVERS[key] = COMPILE_SERVER_DEFAULTS[key];
+                        } else if (cs.is_object()) {
+                            CompileServerSpec spec;
+                            spec.mode = cs.value("mode", "command");
+                            spec.buildCmd = cs.value("build_cmd", "");
+                            spec.start = cs.value("start", "");
+                            spec.stop = cs.value("stop", "");
+                            COMPILE_SERVERS[key] = spec;
+                        }
+                    }
                 }
             }
         }
@@ -245,129 +1120,862 @@ bool loadConfig(string mode) {
     } catch (...) { return false; }
 }
 
-// --- AI CORE ---
-string callAI(string prompt) {
-    string response;
-    string url = API_URL;
-    
-    json body;
-    string extraHeaders = "";
-
-    if (PROTOCOL == "google") {
-        body["contents"][0]["parts"][0]["text"] = prompt;
-        if (url.find("?key=") == string::npos) url += "?key=" + API_KEY;
-    } 
-    else if (PROTOCOL == "openai") {
-        body["model"] = MODEL_ID;
-        
-        // [FIX] Handle APIFreeLLM divergence 
-        if (API_URL.find("apifreellm.com") != string::npos) {
-            body["message"] = prompt; 
-        } else {
-            body["messages"][0]["role"] = "user";
-            body["messages"][0]["content"] = prompt;
-        }
-        
-        extraHeaders = " -H \"Authorization: Bearer " + API_KEY + "\"";
-    }
-    else { 
-        body["model"] = MODEL_ID;
-        body["prompt"] = prompt;
-        body["stream"] = false; 
+// --- MODEL CASCADE ---
+// [NEW] Picks the tier for a pass: the first tier whose pass budget is not yet used up and
+// whose prompt limit fits. Returns -1 when no cascade is configured.
+int selectTier(int failedPasses, size_t promptChars) {
+    if (CASCADE.empty()) return -1;
+    int budget = 0;
+    for (int i = 0; i < (int)CASCADE.size(); i++) {
+        const ModelTier& t = CASCADE[i];
+        bool fits = (t.maxPromptChars == 0 || promptChars <= t.maxPromptChars);
+        if (t.maxPasses == 0) { if (fits) return i; continue; }
+        budget += t.maxPasses;
+        if (fits && failedPasses < budget) return i;
     }
+    return (int)CASCADE.size() - 1;
+}
 
-    for(int i=0; i<3; i++) {
-        ofstream file("request_temp.json"); 
-        file << body.dump(-1, ' ', false, json::error_handler_t::replace); 
-        file.close();
-        
-        string verbosity = VERBOSE_MODE ? " -v" : " -s";
-        string cmd = "curl" + verbosity + " -X POST -H \"Content-Type: application/json\"" + extraHeaders + " -d @request_temp.json \"" + url + "\"";
-        
-        CmdResult res = execCmd(cmd);
-        response = res.output;
-        remove("request_temp.json");
-        
-        if (VERBOSE_MODE) cout << "\n[DEBUG] Raw Response: " << response << endl;
+CallOptions tierOptions(int tier) {
+    if (tier < 0) return {};
+    return {CASCADE[tier].profile, CASCADE[tier].model};
+}
 
-        if (response.find("401 Unauthorized") != string::npos) return "ERROR: 401 Unauthorized (Check API Key)";
-        if (response.find("404 Not Found") != string::npos) return "ERROR: 404 Not Found (Check URL)";
+// Per-tier latency/success statistics, accumulated across runs so the cascade can be tuned
+void recordTierResult(int tier, double latencyMs, bool green) {
+    if (tier < 0) return;
+    string path = CACHE_DIR + "/cascade_stats.json";
+    error_code ec;
+    fs::create_directories(CACHE_DIR, ec);
+    // [FIX] Concurrent yori processes update the same file: serialize the read-modify-write
+    // on a lock file (for a bounded time, the counts are advisory) and swap the result in
+    FileLock lock;
+    for (int i = 0; i < 100 && !lock.tryLock(path + ".lock"); i++) this_thread::sleep_for(chrono::milliseconds(20));
+    json stats = json::object();
+    try {
+        if (fs::exists(path)) { ifstream f(path); stats = json::parse(f); }
+    } catch (...) { stats = json::object(); }
+
+    json& s = stats[CASCADE[tier].name];
+    if (!s.is_object()) s = json::object();
+    s["passes"] = s.value("passes", 0) + 1;
+    s["green"] = s.value("green", 0) + (green ? 1 : 0);
+    s["total_latency_ms"] = s.value("total_latency_ms", 0.0) + latencyMs;
+    string tmp = makeTempName(path, ".tmp");
+    { ofstream o(tmp); o << stats.dump(4); }
+    fs::rename(tmp, path, ec);
+    if (ec) fs::remove(tmp, ec);
+    lock.unlock();
+    log("CASCADE", CASCADE[tier].name + (green ? " green" : " failed") + " in " + to_string((long long)latencyMs) + "ms");
+}
 
-        if (response.find("Missing required parameter") != string::npos) {
-             cout << "\n[DEBUG] API rejected payload. Sending: " << body.dump() << endl;
+void showCascadeStats() {
+    string path = CACHE_DIR + "/cascade_stats.json";
+    if (!fs::exists(path)) return;
+    try {
+        ifstream f(path);
+        json stats = json::parse(f);
+        cout << "\n[CASCADE STATS]\n";
+        for (auto& [name, s] : stats.items()) {
+            int passes = s.value("passes", 0);
+            if (passes == 0) continue;
+            cout << "  " << name << ": " << passes << " passes, "
+                 << (100 * s.value("green", 0) / passes) << "% green, avg "
+                 << formatDuration((long long)(s.value("total_latency_ms", 0.0) / passes / 1000)) << " per generation" << endl;
         }
+    } catch (...) {}
+}
+
+// --- TOOLCHAIN PROBE CACHE ---
+// [NEW] Version probes (`g++ --version`, `kotlinc -version`, ...) are cached by the resolved
+// executable path and its mtime, so repeat runs skip JVM/.NET startup entirely.
+struct ToolchainInfo {
+    bool found = false;
+    string version;  // First line of the version output
+    string exePath;
+    bool cached = false;
+};
 
-        if (PROTOCOL == "google" && response.find("429") != string::npos) { 
-             log("WARN", "API 429 Rate Limit. Backoff...");
-             this_thread::sleep_for(chrono::seconds(5 * (i+1)));
-             continue; 
+string resolveExecutable(const string& name) {
+    if (name.empty()) return "";
+    if (name.find('/') != string::npos || name.find('\\') != string::npos) {
+        return fs::exists(name) ? fs::absolute(name).string() : "";
+    }
+    const char* pathEnv = getenv("PATH");
+    if (!pathEnv) return "";
+    #ifdef _WIN32
+    const char sep = ';';
+    vector<string> exts = {"", ".exe", ".cmd", ".bat", ".com"};
+    #else
+    const char sep = ':';
+    vector<string> exts = {""};
+    #endif
+    stringstream ss(pathEnv);
+    string dir;
+    while (getline(ss, dir, sep)) {
+        if (dir.empty()) continue;
+        for (const auto& ext : exts) {
+            std::error_code ec;
+            fs::path candidate = fs::path(dir) / (name + ext);
+            if (fs::is_regular_file(candidate, ec)) return candidate.string();
         }
-        break;
     }
-    return response;
+    return "";
 }
 
-string extractCode(string jsonResponse) {
-    if (jsonResponse.empty()) return "ERROR: Empty response from API";
-    if (jsonResponse.find("ERROR:") == 0) return jsonResponse;
-
-    try {
-        json j = json::parse(jsonResponse);
-        string raw = "";
-        
-        if (j.contains("error")) {
-            if (j["error"].is_object() && j["error"].contains("message")) 
-                return "ERROR: API Error - " + j["error"]["message"].get<string>();
-            return "ERROR: " + j["error"].dump();
-        }
-        
-        if (j.contains("choices") && j["choices"].size() > 0) {
-            if (j["choices"][0].contains("message"))
-                raw = j["choices"][0]["message"]["content"];
-            else if (j["choices"][0].contains("text"))
-                raw = j["choices"][0]["text"];
-        }
-        else if (j.contains("candidates") && j["candidates"].size() > 0) {
-             raw = j["candidates"][0]["content"]["parts"][0]["text"];
-        }
-        else if (j.contains("response")) {
-            raw = j["response"];
-        } 
-        else {
-            return "ERROR: UNKNOWN_RESPONSE_FORMAT: " + jsonResponse.substr(0, 100);
+ToolchainInfo probeToolchain(const string& versionCmd) {
+    ToolchainInfo info;
+    string exe = versionCmd.substr(0, versionCmd.find(' '));
+    info.exePath = resolveExecutable(exe);
+
+    string key, mtime;
+    string cachePath = CACHE_DIR + "/toolchains.json";
+    json cache = json::object();
+    if (!info.exePath.empty()) {
+        std::error_code ec;
+        auto stamp = fs::last_write_time(info.exePath, ec);
+        if (!ec) {
+            key = info.exePath + "|" + versionCmd;
+            mtime = to_string(stamp.time_since_epoch().count());
+            try {
+                if (fs::exists(cachePath)) { ifstream f(cachePath); cache = json::parse(f); }
+            } catch (...) { cache = json::object(); }
+            if (cache.contains(key) && cache[key].value("mtime", "") == mtime) {
+                info.found = cache[key].value("found", false);
+                info.version = cache[key].value("version", "");
+                info.cached = true;
+                return info;
+            }
         }
-        
-        size_t start = raw.find("```"); 
-        if (start == string::npos) return raw; 
-        size_t end_line = raw.find('\n', start); 
-        size_t end_block = raw.rfind("```");
-        if (end_line != string::npos && end_block != string::npos && end_block > end_line) {
-            return raw.substr(end_line + 1, end_block - end_line - 1);
-        }
-        return raw;
-    } catch (const exception& e) { 
-        string safeMsg = jsonResponse;
-        if (safeMsg.length() > 200) safeMsg = safeMsg.substr(0, 200) + "...";
-        replace(safeMsg.begin(), safeMsg.end(), '\n', ' ');
-        return "ERROR: JSON Parsing Failed. Response was: " + safeMsg; 
     }
+
+    CmdResult res = execCmd(versionCmd);
+    info.found = (res.exitCode == 0);
+    stringstream out(res.output);
+    string line;
+    while (getline(out, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty()) { info.version = line; break; }
+    }
+
+    if (!key.empty()) {
+        try {
+            std::error_code ec;
+            fs::create_directories(CACHE_DIR, ec);
+            cache[key] = {{"mtime", mtime}, {"found", info.found}, {"version", info.version}};
+            string tmp = makeTempName(cachePath, ".tmp");
+            { ofstream o(tmp); o << cache.dump(4); }
+            fs::rename(tmp, cachePath, ec);
+            if (ec) fs::remove(tmp, ec);
+        } catch (...) {}
+    }
+    return info;
 }
 
-void explainFatalError(const string& errorMsg) {
-    cout << "\n[YORI ASSISTANT] ANALYZING fatal error..." << endl;
-    string prompt = "ROLE: Helpful Tech Support.\nTASK: Fix missing file error.\nERROR: " + errorMsg.substr(0, 500) + "\nOUTPUT: Short advice.";
-    string advice = callAI(prompt);
-    
-    try {
-        json j = json::parse(advice);
-        if (j.contains("candidates")) advice = j["candidates"][0]["content"]["parts"][0]["text"];
-        else if (j.contains("response")) advice = j["response"];
-        else if (j.contains("choices")) advice = j["choices"][0]["message"]["content"];
-    } catch(...) {}
-    cout << "> Proposed solution: " << advice << endl;
+// Seconds the provider asked us to wait: Retry-After header, rate-limit reset headers or
+// Google's "retryDelay" in the body. 0 when nothing usable was sent.
+double parseRetryAfter(const string& headers, const string& body) {
+    string v = headerValue(headers, "retry-after");
+    if (!v.empty() && isdigit((unsigned char)v[0])) return parseDurationSec(v);
+    if (headerValue(headers, "x-ratelimit-remaining-requests") == "0") return parseDurationSec(headerValue(headers, "x-ratelimit-reset-requests"));
+    if (headerValue(headers, "x-ratelimit-remaining-tokens") == "0") return parseDurationSec(headerValue(headers, "x-ratelimit-reset-tokens"));
+    size_t delay = body.find("\"retryDelay\"");
+    if (delay != string::npos) {
+        size_t colon = body.find(':', delay);
+        if (colon != string::npos) return parseDurationSec(body.substr(colon + 1, 16));
+    }
+    return 0;
 }
 
-// --- CONFIG COMMANDS ---
+// [NEW] Ollama warm-up: an empty-prompt request makes the server load the model, so the
+// load overlaps with toolchain checks, import resolution and preflight instead of
+// stalling the first pass. Fire-and-forget; the real request simply finds the model resident.
+void startModelWarmUp(int tier) {
+    CallOptions opt = tierOptions(tier);
+    string group = opt.profile.empty() ? PROVIDER : opt.profile;
+    vector<Backend> targets;
+    for (const auto& b : BACKENDS) {
+        if (b.group == group && b.protocol == "ollama" && !b.url.empty()) targets.push_back(b);
+    }
+    if (targets.empty()) return;
+
+    // Request files of warm-ups still running at exit are swept here
+    static mutex pendingMutex;
+    static set<string> pending;
+    static bool sweepRegistered = false;
+    if (!sweepRegistered) {
+        sweepRegistered = true;
+        atexit([]() {
+            lock_guard<mutex> lock(pendingMutex);
+            for (const auto& f : pending) remove(f.c_str());
+        });
+    }
+
+    for (auto& b : targets) {
+        json body;
+        body["model"] = opt.model.empty() ? b.modelId : opt.model;
+        if (!b.keepAlive.is_null()) body["keep_alive"] = b.keepAlive;
+        // Load-time options (num_ctx, ...) must match the real requests or Ollama reloads the runner
+        if (b.options.is_object() && !b.options.empty()) body["options"] = b.options;
+        string reqFile = makeTempName("warmup_temp", ".json");
+        { ofstream file(reqFile); file << body.dump(); }
+        { lock_guard<mutex> lock(pendingMutex); pending.insert(reqFile); }
+        #ifdef _WIN32
+        string sink = "NUL";
+        #else
+        string sink = "/dev/null";
+        #endif
+        string cmd = "curl -s --max-time 600 -X POST -H \"Content-Type: application/json\" -d @" + reqFile + " -o " + sink + " \"" + b.url + "\"";
+        log("INFO", "Warming up " + body["model"].get<string>() + " on " + b.name);
+        thread([cmd, reqFile]() {
+            execCmd(cmd);
+            lock_guard<mutex> lock(pendingMutex);
+            remove(reqFile.c_str());
+            pending.erase(reqFile);
+        }).detach();
+    }
+}
+
+// [NEW] Wait before re-issuing a failed generation. Throttled providers are paced by
+// their limiter, so we only wait until the first backend is ready again instead of a
+// fixed 5*(n+1)s; other errors get a short capped exponential backoff.
+void backoffAfterApiError(const string& error, int attempt) {
+    bool rateLimited = error.find("Rate limit") != string::npos || error.find("429") != string::npos ||
+                       error.find("RESOURCE_EXHAUSTED") != string::npos || error.find("rate_limit") != string::npos;
+    auto now = chrono::steady_clock::now();
+    chrono::milliseconds wait(0);
+    if (rateLimited) {
+        auto earliest = chrono::steady_clock::time_point::max();
+        {
+            lock_guard<mutex> lock(BACKEND_MUTEX); // Pool threads update blockedUntil concurrently
+            for (const auto& b : BACKENDS) earliest = min(earliest, b.limiter ? max(b.blockedUntil, b.limiter->readyAt()) : b.blockedUntil);
+        }
+        if (earliest != chrono::steady_clock::time_point::max() && earliest > now) wait = chrono::duration_cast<chrono::milliseconds>(earliest - now);
+        cout << "       -> Rate limit detected. Waiting " << formatDuration((wait.count() + 999) / 1000) << " for the provider window..." << endl;
+    } else {
+        wait = chrono::milliseconds(500LL << min(attempt, 5));
+        cout << "       -> Retrying in " << formatDuration((wait.count() + 999) / 1000) << "..." << endl;
+    }
+    this_thread::sleep_for(wait);
+}
+
+// [NEW] Scatter-gather prompt. Instructions are small owned pieces; large inputs (the
+// aggregated sources, old code, project context) are borrowed by reference and only ever
+// streamed, JSON-escaped, into the request file. Borrowed strings must outlive the buffer.
+// [NEW] Text is filed under sections and emitted from most to least stable, whatever order the
+// builder wrote it in. Everything before PASS is then a byte-identical prefix across retries
+// (and across the chunks of one file), which Ollama's KV cache and provider prompt caches reuse.
+class PromptBuffer {
+public:
+    enum Section { SYSTEM, LANGUAGE, MODULES, HOST, PASS, SECTION_COUNT };
+
+    PromptBuffer& section(Section s) { current = s; return *this; }
+    PromptBuffer& operator<<(const string& s) { own().append(s); return *this; }
+    PromptBuffer& operator<<(const char* s) { own().append(s); return *this; }
+    PromptBuffer& operator<<(char c) { own().push_back(c); return *this; }
+    template <typename T, typename = enable_if_t<is_arithmetic_v<T>>>
+    PromptBuffer& operator<<(T v) { own().append(to_string(v)); return *this; }
+    PromptBuffer& ref(const string& s) { parts.push_back({"", &s, current}); return *this; }
+
+    size_t size() const {
+        size_t n = 0;
+        for (const auto& p : parts) n += p.ref ? p.ref->size() : p.text.size();
+        return n;
+    }
+    string str() const {
+        string out;
+        out.reserve(size());
+        forEach([&](string_view s) { out += s; });
+        return out;
+    }
+    // Writes the prompt as a quoted JSON string; invalid UTF-8 becomes U+FFFD
+    void writeJson(ostream& out) const {
+        out.put('"');
+        forEach([&](string_view s) { writeEscaped(out, s); });
+        out.put('"');
+    }
+    // FNV-1a of the stable sections (everything before PASS); empty when there are none
+    string cacheKey() const {
+        uint64_t h = 1469598103934665603ULL;
+        bool any = false;
+        forEach([&](string_view s) {
+            for (unsigned char c : s) { h ^= c; h *= 1099511628211ULL; }
+            any = any || !s.empty();
+        }, PASS);
+        if (!any) return "";
+        stringstream ss;
+        ss << hex << setw(16) << setfill('0') << h;
+        return ss.str();
+    }
+
+private:
+    struct Part { string text; const string* ref; Section section; };
+    vector<Part> parts;
+    Section current = SYSTEM;
+
+    string& own() {
+        if (parts.empty() || parts.back().ref || parts.back().section != current) parts.push_back({"", nullptr, current});
+        return parts.back().text;
+    }
+    // Visits the parts section by section, in the order they were written within a section
+    template <typename F>
+    void forEach(F&& fn, Section end = SECTION_COUNT) const {
+        for (int sec = SYSTEM; sec < end; sec++) {
+            for (const auto& p : parts) if (p.section == sec) fn(string_view(p.ref ? *p.ref : p.text));
+        }
+    }
+    static void writeEscaped(ostream& out, string_view s) {
+        size_t run = 0; // Start of the pending run of bytes that need no escaping
+        auto flush = [&](size_t i) { if (i > run) out.write(s.data() + run, i - run); };
+        for (size_t i = 0; i < s.size();) {
+            unsigned char c = s[i];
+            if (c >= 0x20 && c != '"' && c != '\\' && c < 0x80) { i++; continue; }
+            if (c >= 0x80) {
+                size_t len = (c >= 0xF0 && c <= 0xF4) ? 4 : (c >= 0xE0) ? 3 : (c >= 0xC2 && c <= 0xDF) ? 2 : 0;
+                bool valid = len > 0 && i + len <= s.size();
+                for (size_t k = 1; valid && k < len; k++) valid = ((unsigned char)s[i + k] & 0xC0) == 0x80;
+                if (valid && len > 2) {
+                    // Reject overlong forms, UTF-16 surrogates and code points past U+10FFFF
+                    unsigned char c1 = s[i + 1];
+                    valid = !(c == 0xE0 && c1 < 0xA0) && !(c == 0xED && c1 > 0x9F) &&
+                            !(c == 0xF0 && c1 < 0x90) && !(c == 0xF4 && c1 > 0x8F);
+                }
+                if (valid) { i += len; continue; }
+                flush(i);
+                out << "\\ufffd";
+                run = ++i;
+                continue;
+            }
+            flush(i);
+            switch (c) {
+                case '"': out << "\\\""; break;
+                case '\\': out << "\\\\"; break;
+                case '\n': out << "\\n"; break;
+                case '\r': out << "\\r"; break;
+                case '\t': out << "\\t"; break;
+                case '\b': out << "\\b"; break;
+                case '\f': out << "\\f"; break;
+                default: { char esc[8]; snprintf(esc, sizeof(esc), "\\u%04x", c); out << esc; }
+            }
+            run = ++i;
+        }
+        flush(s.size());
+    }
+};
+
+// [NEW] Streaming response reader. Walks the provider reply with nlohmann's SAX
+// interface and moves the one text field we need straight into the result,
+// without building a DOM for multi-hundred-KB generations.
+struct ResponseText {
+    string text;
+    string error;
+    bool found = false;    // A known text field was located
+    bool hasError = false; // Top-level "error" member present
+    bool valid = true;     // Input was JSON (up to the point we stopped reading)
+    json context;          // [NEW] Ollama token context, when requested (null = absent)
+};
+
+class ResponseTextSax : public nlohmann::json_sax<json> {
+public:
+    explicit ResponseTextSax(ResponseText& out, bool captureContext = false) : out(out), captureContext(captureContext) {}
+
+    bool null() override { return scalar(); }
+    bool boolean(bool) override { return scalar(); }
+    bool number_integer(number_integer_t v) override {
+        if (inContext()) out.context.push_back(v);
+        return number(to_string(v));
+    }
+    bool number_unsigned(number_unsigned_t v) override {
+        if (inContext()) out.context.push_back(v);
+        return number(to_string(v));
+    }
+    bool number_float(number_float_t, const string_t& s) override { return number(s); }
+    bool binary(binary_t&) override { return scalar(); }
+
+    bool string(string_t& val) override {
+        if (!out.found && (at({"choices", "0", "message", "content"}) || at({"choices", "0", "text"}) ||
+                           at({"candidates", "0", "content", "parts", "0", "text"}) || at({"response"}))) {
+            out.text = std::move(val);
+            out.found = true;
+            // Everything after the text (e.g. Ollama's token context) is irrelevant unless asked for
+            if (!out.hasError && !captureContext) return false;
+        } else if (at({"error"}) || at({"error", "message"})) {
+            out.error = std::move(val);
+        } else if (at({"error", "status"}) && (out.error.empty() || out.error.rfind("code ", 0) == 0)) {
+            out.error = out.error.empty() ? val : val + " (" + out.error + ")";
+        }
+        return scalar();
+    }
+
+    bool start_object(size_t) override { enter(false); return true; }
+    bool key(string_t& val) override {
+        path.back().key = val;
+        if (path.size() == 1 && val == "error") out.hasError = true;
+        return true;
+    }
+    bool end_object() override { return leave(); }
+    bool start_array(size_t) override {
+        if (captureContext && at({"context"})) out.context = json::array();
+        enter(true);
+        return true;
+    }
+    bool end_array() override { return leave(); }
+
+    bool parse_error(size_t, const std::string&, const nlohmann::detail::exception&) override {
+        out.valid = false;
+        return false;
+    }
+
+private:
+    struct Frame { bool array; size_t index; std::string key; };
+    ResponseText& out;
+    bool captureContext;
+    vector<Frame> path;
+
+    bool inContext() const {
+        return captureContext && path.size() == 2 && !path[0].array && path[0].key == "context" && path[1].array;
+    }
+
+    bool at(initializer_list<const char*> expected) const {
+        if (expected.size() != path.size()) return false;
+        size_t i = 0;
+        for (const char* part : expected) {
+            const Frame& f = path[i++];
+            if (f.array ? (to_string(f.index) != part) : (f.key != part)) return false;
+        }
+        return true;
+    }
+    bool number(const std::string& v) {
+        if (at({"error", "code"}) && out.error.empty()) out.error = "code " + v;
+        return scalar();
+    }
+    bool scalar() {
+        if (!path.empty() && path.back().array) path.back().index++;
+        return true;
+    }
+    void enter(bool array) { path.push_back({array, 0, ""}); }
+    bool leave() {
+        path.pop_back();
+        return scalar();
+    }
+};
+
+ResponseText parseResponseText(const string& response, bool captureContext = false) {
+    ResponseText result;
+    ResponseTextSax handler(result, captureContext);
+    json::sax_parse(response, &handler);
+    return result;
+}
+
+// Returns the reply text, or the raw response when it is not a recognised JSON envelope.
+string extractResponseText(const string& response) {
+    ResponseText r = parseResponseText(response);
+    return r.found ? std::move(r.text) : response;
+}
+
+// [NEW] --max-memory: refuse inputs whose working set would exceed the limit. The context is
+// held once as read and once while containers are expanded; the prompt itself adds no copy.
+bool checkMemoryBudget(size_t bytes, const string& what) {
+    if (MAX_MEMORY_MB == 0) return true;
+    size_t estimateMb = (2 * bytes) / (1024 * 1024) + 1;
+    if (estimateMb <= MAX_MEMORY_MB) return true;
+    cerr << "[ERROR] " << what << " needs ~" << estimateMb << " MB, over the --max-memory limit of " << MAX_MEMORY_MB << " MB." << endl;
+    return false;
+}
+
+string callAI(const PromptBuffer& prompt, const CallOptions& opt = {}) {
+    LogScope scope(makeTempName("req", "")); // Correlates every record of this request
+    string response;
+    string group = opt.profile.empty() ? PROVIDER : opt.profile;
+    int groupSize = (int)count_if(BACKENDS.begin(), BACKENDS.end(), [&](const Backend& b) { return b.group == group; });
+    int attempts = max(3, groupSize * 2);
+
+    for(int i=0; i<attempts; i++) {
+        if (opt.cancel && opt.cancel->load()) return "ERROR: Request cancelled";
+        chrono::milliseconds wait(0);
+        int idx = acquireBackend(wait, opt.profile, opt.session ? opt.session->backend : "");
+        if (idx < 0) {
+            // Every backend is cooling down: sleep until the first one reopens
+            auto capped = min(wait, chrono::milliseconds(60000));
+            log("WARN", "All backends blocked. Waiting " + to_string(capped.count() / 1000) + "s...");
+            this_thread::sleep_for(capped);
+            if (wait <= capped) i--; // Waiting out a short block is not an attempt
+            continue;
+        }
+        Backend backend;
+        { lock_guard<mutex> lock(BACKEND_MUTEX); backend = BACKENDS[idx]; }
+        if (!opt.model.empty() && opt.model != backend.modelId) {
+            // Google encodes the model in the URL
+            size_t m = backend.url.find("/models/" + backend.modelId + ":");
+            if (m != string::npos) backend.url.replace(m + 8, backend.modelId.length(), opt.model);
+            backend.modelId = opt.model;
+        }
+
+        string url = backend.url;
+        json body;
+        string extraHeaders = "";
+        // Stand-in for the prompt; the real text is streamed in when the request file is written
+        const string promptSlot = "\x01YORI_PROMPT\x01";
+        PromptBuffer followUp; // Set when an Ollama session makes the full prompt unnecessary
+
+        if (backend.protocol == "google") {
+            body["contents"][0]["parts"][0]["text"] = promptSlot;
+            if (url.find("?key=") == string::npos) url += "?key=" + backend.apiKey;
+        } 
+        else if (backend.protocol == "openai") {
+            body["model"] = backend.modelId;
+            
+            // [FIX] Handle APIFreeLLM divergence 
+            if (url.find("apifreellm.com") != string::npos) {
+                body["message"] = promptSlot; 
+            } else {
+                body["messages"][0]["role"] = "user";
+                body["messages"][0]["content"] = promptSlot;
+            }
+            // [NEW] Route requests sharing a stable prefix to the same prompt cache
+            string cacheKey = prompt.cacheKey();
+            if (!cacheKey.empty() && url.find("api.openai.com") != string::npos) body["prompt_cache_key"] = "yori-" + cacheKey;
+            
+            extraHeaders = " -H \"Authorization: Bearer " + backend.apiKey + "\"";
+        }
+        else { 
+            body["model"] = backend.modelId;
+            body["prompt"] = promptSlot;
+            body["stream"] = false; 
+            if (!backend.keepAlive.is_null()) body["keep_alive"] = backend.keepAlive;
+            if (backend.options.is_object() && !backend.options.empty()) body["options"] = backend.options;
+            // [NEW] Continue the session when it was built on this backend and model and the
+            // follow-up still fits the context window (num_ctx, or the server's conservative default)
+            if (opt.session && backend.session && !opt.followUp.empty() && opt.session->context.is_array() &&
+                opt.session->backend == backend.name && opt.session->model == backend.modelId) {
+                size_t numCtx = backend.options.is_object() ? backend.options.value("num_ctx", (size_t)0) : 0;
+                if (numCtx == 0) numCtx = OLLAMA_DEFAULT_NUM_CTX;
+                size_t tokens = opt.session->context.size() + opt.followUp.size() / 3;
+                if (tokens < numCtx * 9 / 10) {
+                    body["context"] = opt.session->context;
+                    followUp.ref(opt.followUp);
+                    log("INFO", "Session: continuing " + to_string(opt.session->context.size()) + " context tokens on " + backend.name);
+                }
+            }
+        }
+
+        string reqFile = makeTempName("request_temp", ".json");
+        string respFile = makeTempName("response_temp", ".json");
+        string headFile = makeTempName("headers_temp", ".txt");
+        {
+            string envelope = body.dump(-1, ' ', false, json::error_handler_t::replace);
+            const string slotJson = json(promptSlot).dump();
+            size_t slot = envelope.find(slotJson);
+            vector<char> ioBuf(1 << 16);
+            ofstream file;
+            file.rdbuf()->pubsetbuf(ioBuf.data(), ioBuf.size());
+            file.open(reqFile, ios::binary);
+            file.write(envelope.data(), slot);
+            (followUp.size() > 0 ? followUp : prompt).writeJson(file);
+            file.write(envelope.data() + slot + slotJson.size(), envelope.size() - slot - slotJson.size());
+        }
+        
+        string verbosity = VERBOSE_MODE ? " -v" : " -s";
+        string cmd = "curl" + verbosity + " -X POST -H \"Content-Type: application/json\"" + extraHeaders +
+                     " -d @" + reqFile + " -o " + respFile + " -D " + headFile + " -w \"\\nYORI_HTTP_STATUS:%{http_code}\\n\" \"" + url + "\"";
+        
+        backend.limiter->acquire();
+        // [NEW] A local model server is shared by every yori process on the machine:
+        // its max_concurrent becomes a machine-wide slot count
+        FileLock llmSlot;
+        if (backend.protocol == "ollama") {
+            string server = url.substr(0, url.find('/', url.find("://") + 3));
+            stringstream pool;
+            pool << "llm-" << hex << hash<string>{}(server);
+            if (!acquireSlot(pool.str(), backend.limiter->concurrency(), opt.cancel, "model", llmSlot)) {
+                backend.limiter->release();
+                releaseBackend(idx, true, 0, 0);
+                remove(reqFile.c_str());
+                return "ERROR: Request cancelled";
+            }
+        }
+        auto t0 = chrono::steady_clock::now();
+        CmdResult res = execCmd(cmd, opt.cancel);
+        llmSlot.unlock();
+        backend.limiter->release();
+        double latencyMs = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+
+        int status = 0;
+        size_t statusPos = res.output.rfind("YORI_HTTP_STATUS:");
+        if (statusPos != string::npos) {
+            try { status = stoi(res.output.substr(statusPos + 17, 3)); } catch (...) { status = 0; }
+        }
+        ifstream rf(respFile);
+        response.assign(istreambuf_iterator<char>(rf), istreambuf_iterator<char>());
+        rf.close();
+        ifstream hf(headFile);
+        string headers((istreambuf_iterator<char>(hf)), istreambuf_iterator<char>());
+        hf.close();
+        remove(reqFile.c_str());
+        remove(respFile.c_str());
+        remove(headFile.c_str());
+        if (opt.cancel && opt.cancel->load()) {
+            releaseBackend(idx, true, latencyMs, 0);
+            return "ERROR: Request cancelled";
+        }
+        
+        if (VERBOSE_MODE) {
+            // Whole replies can be megabytes; the head is enough to diagnose a bad payload
+            cout << "\n[DEBUG] " << backend.name << " HTTP " << status << " Raw Response (" << response.size() << " bytes): "
+                 << response.substr(0, 2000) << (response.size() > 2000 ? " ..." : "") << endl;
+            // [NEW] How much of the prompt the server had to evaluate vs. took from its cache
+            json usage = json::parse(response, nullptr, false);
+            if (usage.is_object()) {
+                if (usage.contains("prompt_eval_count")) {
+                    cout << "[DEBUG] Prompt tokens evaluated: " << usage["prompt_eval_count"] << ", prompt time "
+                         << usage.value("prompt_eval_duration", 0LL) / 1000000 << " ms" << endl;
+                } else if (usage.contains("usage") && usage["usage"].contains("prompt_tokens_details")) {
+                    cout << "[DEBUG] Cached prompt tokens: " << usage["usage"]["prompt_tokens_details"].value("cached_tokens", 0)
+                         << " of " << usage["usage"].value("prompt_tokens", 0) << endl;
+                }
+            }
+        }
+
+        bool ok = (status >= 200 && status < 300);
+        bool throttled = (status == 429 || status == 503);
+        double retryAfter = throttled ? parseRetryAfter(headers, response) : 0;
+        if (ok) {
+            string remaining = headerValue(headers, "x-ratelimit-remaining-requests");
+            int left = -1;
+            try { if (!remaining.empty()) left = stoi(remaining); } catch (...) {}
+            backend.limiter->onSuccess(left, parseDurationSec(headerValue(headers, "x-ratelimit-reset-requests")));
+        } else if (throttled) {
+            backend.limiter->onThrottle(retryAfter);
+        }
+        // The limiter paces throttled providers; the pool only blocks on explicit Retry-After
+        releaseBackend(idx, ok, latencyMs, (int)ceil(retryAfter));
+        if (ok && opt.session) {
+            // [NEW] Remember the conversation for the next pass (or forget it if there is none)
+            // [FIX] Read with the streaming reader: no DOM for the whole reply
+            ResponseText reply;
+            if (backend.protocol == "ollama" && backend.session) reply = parseResponseText(response, true);
+            if (reply.context.is_array()) {
+                *opt.session = {move(reply.context), backend.name, backend.modelId};
+            } else {
+                *opt.session = {};
+            }
+        }
+        if (ok) break;
+        // [FIX] A failed request may have lost the server-side state: the next attempt sends the full prompt
+        if (opt.session) *opt.session = {};
+
+        log("WARN", "Backend " + backend.name + " failed (HTTP " + to_string(status) + ").");
+        if (response.find("Missing required parameter") != string::npos) {
+             cout << "\n[DEBUG] API rejected payload. Sending: " << body.dump() << endl;
+        }
+
+        if (groupSize <= 1) {
+            if (status == 401) return "ERROR: 401 Unauthorized (Check API Key)";
+            if (status == 404) return "ERROR: 404 Not Found (Check URL)";
+            if (throttled || status >= 500 || status == 0) {
+                // The limiter now holds the next request back exactly as long as needed
+                if (throttled) log("WARN", "API " + to_string(status) + " Rate Limit. Pacing requests...");
+                else if (i + 1 < attempts) {
+                    // [FIX] A down or restarting server is not throttling: back off briefly instead
+                    auto until = chrono::steady_clock::now() + chrono::milliseconds(500LL << min(i, 5));
+                    log("WARN", "Server error (HTTP " + to_string(status) + "). Retrying in " + to_string(500LL << min(i, 5)) + " ms...");
+                    while (chrono::steady_clock::now() < until && !(opt.cancel && opt.cancel->load())) this_thread::sleep_for(chrono::milliseconds(50));
+                }
+                continue;
+            }
+            break;
+        }
+        // [NEW] Pool: failover to the next backend; bad credentials/URLs take this one out for a while
+        if (status == 401 || status == 403 || status == 404) {
+            lock_guard<mutex> lock(BACKEND_MUTEX);
+            BACKENDS[idx].blockedUntil = chrono::steady_clock::now() + chrono::minutes(10);
+        }
+        if (i + 1 < attempts) cout << "   [FAILOVER] " << backend.name << " unavailable (HTTP " << status << "). Switching backend..." << endl;
+    }
+    if (response.empty()) return "ERROR: No response from any backend (check that the server is running)";
+    return response;
+}
+
+string callAI(const string& prompt, const CallOptions& opt = {}) {
+    PromptBuffer buffer;
+    buffer.ref(prompt);
+    return callAI(buffer, opt);
+}
+
+// [NEW] Markdown fence scanner. One pass over the reply records every fenced block
+// (including nested and unterminated ones) as a view into the original text.
+struct FencedBlock {
+    string_view tag;
+    string_view body;
+    int depth;
+};
+
+bool fenceTagMatches(string_view tag, const LangProfile& lang) {
+    if (tag.empty() || lang.id.empty()) return false;
+    string t(tag.substr(0, tag.find_first_of(" \t{")));
+    transform(t.begin(), t.end(), t.begin(), ::tolower);
+    string name = lang.name;
+    transform(name.begin(), name.end(), name.begin(), ::tolower);
+    if (t == lang.id || t == name || (!lang.extension.empty() && t == lang.extension.substr(1))) return true;
+
+    static const map<string, vector<string>> aliases = {
+        {"cpp", {"c++", "cxx", "cc", "hpp"}}, {"py", {"python", "python3"}}, {"js", {"javascript", "node"}},
+        {"ts", {"typescript"}}, {"rust", {"rs"}}, {"cs", {"csharp", "c#"}}, {"sh", {"bash", "shell", "zsh"}},
+        {"kt", {"kotlin"}}, {"rb", {"ruby"}}, {"go", {"golang"}}, {"hs", {"haskell"}}, {"jl", {"julia"}},
+        {"pl", {"perl"}}, {"ps1", {"powershell", "pwsh"}}, {"fs", {"fsharp", "f#"}}, {"vb", {"vbnet", "vb.net"}},
+        {"html", {"htm"}}, {"yaml", {"yml"}}, {"tex", {"latex"}}
+    };
+    auto it = aliases.find(lang.id);
+    if (it == aliases.end()) return false;
+    return find(it->second.begin(), it->second.end(), t) != it->second.end();
+}
+
+vector<FencedBlock> scanFencedBlocks(string_view text) {
+    struct Open { char ch; size_t len; string_view tag; size_t bodyStart; };
+    vector<FencedBlock> blocks;
+    vector<Open> open;
+    size_t pos = 0;
+
+    while (pos < text.length()) {
+        size_t eol = text.find('\n', pos);
+        size_t lineEnd = (eol == string_view::npos) ? text.length() : eol;
+        size_t next = (eol == string_view::npos) ? text.length() : eol + 1;
+        string_view line = text.substr(pos, lineEnd - pos);
+
+        size_t first = line.find_first_not_of(" \t");
+        if (first != string_view::npos && (line[first] == '`' || line[first] == '~')) {
+            char ch = line[first];
+            size_t run = line.find_first_not_of(ch, first);
+            size_t len = (run == string_view::npos ? line.length() : run) - first;
+            if (len >= 3) {
+                string_view info = (run == string_view::npos) ? string_view() : line.substr(run);
+                size_t a = info.find_first_not_of(" \t\r");
+                size_t b = info.find_last_not_of(" \t\r");
+                info = (a == string_view::npos) ? string_view() : info.substr(a, b - a + 1);
+
+                // A bare fence at least as long as the innermost opener closes it;
+                // a tagged fence inside a block opens a nested one.
+                if (!open.empty() && info.empty() && ch == open.back().ch && len >= open.back().len) {
+                    Open o = open.back(); open.pop_back();
+                    blocks.push_back({o.tag, text.substr(o.bodyStart, pos - o.bodyStart), (int)open.size()});
+                    pos = next; continue;
+                }
+                if (open.empty() || !info.empty()) {
+                    open.push_back({ch, len, info, next});
+                    pos = next; continue;
+                }
+            }
+        }
+        pos = next;
+    }
+    // Unterminated fences (truncated or streamed replies) run to the end of the text
+    while (!open.empty()) {
+        Open o = open.back(); open.pop_back();
+        blocks.push_back({o.tag, text.substr(min(o.bodyStart, text.length())), (int)open.size()});
+    }
+    return blocks;
+}
+
+// Picks the block tagged with the target language, falling back to the largest top-level block.
+string_view selectCodeBlock(string_view text, const LangProfile& lang) {
+    vector<FencedBlock> blocks = scanFencedBlocks(text);
+    if (blocks.empty()) return text;
+
+    const FencedBlock* best = nullptr;
+    for (const auto& b : blocks) {
+        if (fenceTagMatches(b.tag, lang) && (!best || b.body.length() > best->body.length())) best = &b;
+    }
+    if (best) return best->body;
+    for (const auto& b : blocks) {
+        if (b.depth == 0 && (!best || b.body.length() > best->body.length())) best = &b;
+    }
+    return best ? best->body : text;
+}
+
+// [FIX] Multi-file (EXPORT) replies are never narrowed to one block: fences that wrap the whole
+// reply or one file body are dropped, everything else (fences inside a README, ...) is kept.
+string stripExportFences(string_view text) {
+    auto trimmed = [](string_view l) {
+        size_t a = l.find_first_not_of(" \t\r");
+        if (a == string_view::npos) return string_view();
+        return l.substr(a, l.find_last_not_of(" \t\r") - a + 1);
+    };
+    auto isFence = [&](string_view l) { l = trimmed(l); return l.rfind("```", 0) == 0 || l.rfind("~~~", 0) == 0; };
+    auto isExport = [&](string_view l) { return trimmed(l).rfind("EXPORT:", 0) == 0; };
+    auto isEnd = [&](string_view l) { return isExport(l) && trimmed(trimmed(l).substr(7)) == "END"; };
+
+    vector<string_view> lines;
+    for (size_t pos = 0; pos <= text.size();) {
+        size_t eol = text.find('\n', pos);
+        if (eol == string_view::npos) eol = text.size();
+        lines.push_back(text.substr(pos, eol - pos));
+        pos = eol + 1;
+    }
+    vector<bool> drop(lines.size(), false);
+    bool inside = false, fenced = false; // Inside a file body / its first line was a fence
+    auto closeBody = [&](size_t at) {
+        if (!inside || !fenced) return;
+        size_t k = at;
+        while (k > 0 && trimmed(lines[k - 1]).empty()) k--;
+        if (k > 0 && isFence(lines[k - 1]) && !drop[k - 1]) drop[k - 1] = true;
+    };
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (isExport(lines[i])) {
+            closeBody(i);
+            inside = !isEnd(lines[i]);
+            fenced = false;
+            if (inside) {
+                size_t k = i + 1;
+                while (k < lines.size() && trimmed(lines[k]).empty()) k++;
+                if (k < lines.size() && isFence(lines[k])) { drop[k] = true; fenced = true; }
+            }
+            continue;
+        }
+        if (!inside && isFence(lines[i])) drop[i] = true;
+    }
+    if (inside) closeBody(lines.size()); // Reply ended without EXPORT: END
+
+    string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (drop[i]) continue;
+        out.append(lines[i]);
+        if (i + 1 < lines.size()) out += '\n';
+    }
+    return out;
+}
+
+string extractCode(const string& jsonResponse, const LangProfile& lang = CURRENT_LANG) {
+    if (jsonResponse.empty()) return "ERROR: Empty response from API";
+    if (jsonResponse.find("ERROR:") == 0) return jsonResponse;
+
+    ResponseText r = parseResponseText(jsonResponse);
+    if (!r.valid && !r.found) {
+        string safeMsg = jsonResponse;
+        if (safeMsg.length() > 200) safeMsg = safeMsg.substr(0, 200) + "...";
+        replace(safeMsg.begin(), safeMsg.end(), '\n', ' ');
+        return "ERROR: JSON Parsing Failed. Response was: " + safeMsg; 
+    }
+    if (r.hasError && !r.found) {
+        return "ERROR: API Error - " + (r.error.empty() ? string("unknown error") : r.error);
+    }
+    if (!r.found) {
+        return "ERROR: UNKNOWN_RESPONSE_FORMAT: " + jsonResponse.substr(0, 100);
+    }
+
+    // [NEW] Take the block in the target language instead of first-to-last fence
+    if (r.text.find("EXPORT:") != string::npos) return stripExportFences(r.text);
+    return string(selectCodeBlock(r.text, lang));
+}
+
+void explainFatalError(const string& errorMsg) {
+    cout << "\n[YORI ASSISTANT] ANALYZING fatal error..." << endl;
+    string prompt = "ROLE: Helpful Tech Support.\nTASK: Fix missing file error.\nERROR: " + errorMsg.substr(0, 500) + "\nOUTPUT: Short advice.";
+    string advice = extractResponseText(callAI(prompt));
+    cout << "> Proposed solution: " << advice << endl;
+}
+
+// --- CONFIG COMMANDS ---
 void updateConfigFile(string key, string value) {
     string configPath = "config.json";
     json j;
@@ -440,6 +2048,7 @@ void showConfig() {
             if (c.contains("protocol")) cout << "  Protocol : " << c["protocol"].get<string>() << endl;
             if (c.contains("model_id")) cout << "  Model    : " << c["model_id"].get<string>() << endl;
             if (c.contains("api_url"))  cout << "  URL      : " << c["api_url"].get<string>() << endl;
+            if (c.contains("pool"))     cout << "  Pool     : " << c["pool"].size() << " backends (" << c.value("routing", "least_outstanding") << ")" << endl;
             if (c.contains("api_key")) {
                 string k = c["api_key"].get<string>();
                 if (k.length() > 6) k = k.substr(0, 3) + "..." + k.substr(k.length()-3);
@@ -453,6 +2062,18 @@ void showConfig() {
             auto& l = j["local"];
             if (l.contains("model_id")) cout << "  Model    : " << l["model_id"].get<string>() << endl;
             if (l.contains("api_url"))  cout << "  URL      : " << l["api_url"].get<string>() << endl;
+            if (l.contains("pool"))     cout << "  Pool     : " << l["pool"].size() << " backends (" << l.value("routing", "least_outstanding") << ")" << endl;
+        }
+        if (j.contains("cascade")) {
+            cout << "\n[CASCADE]\n";
+            int n = 1;
+            for (auto& t : j["cascade"]) {
+                cout << "  " << n++ << ". " << t.value("profile", "(active)") << ":" << t.value("model_id", "(profile default)");
+                if (t.contains("max_passes")) cout << " | escalate after " << t["max_passes"] << " failed passes";
+                if (t.contains("max_prompt_chars")) cout << " | prompts <= " << t["max_prompt_chars"] << " chars";
+                cout << endl;
+            }
+            showCascadeStats();
         }
         cout << "--------------------------\n";
     } catch (...) { cout << "[ERROR] Corrupt or invalid config file." << endl; }
@@ -571,10 +2192,6 @@ string resolveImports(string code, fs::path basePath, vector<string>& stack) {
     return processed;
 }
 
-// [NEW] Cache System Constants
-const string CACHE_DIR = "yori_cache";
-const string LOCK_FILE = ".yori.lock";
-
 struct Container {
     string id;
     string prompt;
@@ -625,12 +2242,13 @@ void setCachedContent(const string& id, const string& content) {
 // [NEW] Pre-process input to handle containers and caching
 string processInputWithCache(const string& code, bool useCache, const vector<string>& updateTargets) {
     string result;
+    result.reserve(code.size());
     size_t pos = 0;
     
     while (pos < code.length()) {
         size_t start = code.find("$$", pos);
         if (start == string::npos) {
-            result += code.substr(pos);
+            result.append(code, pos, string::npos);
             break;
         }
 
@@ -660,7 +2278,7 @@ string processInputWithCache(const string& code, bool useCache, const vector<str
             size_t end = code.find("}$$", contentStart);
             if (end == string::npos) {
                 // Malformed, just append and continue
-                result += code.substr(pos, start - pos + 2);
+                result.append(code, pos, start - pos + 2);
                 pos = start + 2;
                 continue;
             }
@@ -668,7 +2286,7 @@ string processInputWithCache(const string& code, bool useCache, const vector<str
             string prompt = code.substr(contentStart, end - contentStart);
             string currentHash = getContainerHash(prompt);
             
-            result += code.substr(pos, start - pos); // Append text before container
+            result.append(code, pos, start - pos); // Append text before container
 
             bool cacheHit = false;
             
@@ -725,7 +2343,7 @@ string processInputWithCache(const string& code, bool useCache, const vector<str
             pos = end + 3; // Skip }$$
         } else {
             // Anonymous or malformed, keep as is (or handle anonymous logic)
-            result += code.substr(pos, start - pos + 2);
+            result.append(code, pos, start - pos + 2);
             pos = start + 2;
         }
     }
@@ -933,56 +2551,55 @@ bool validateContainers(const string& code) {
 }
 
 // --- EXPORT SYSTEM ---
-string processExports(const string& code, const fs::path& basePath) {
-    stringstream ss(code);
-    string line;
-    unique_ptr<ofstream> outFile;
-    string remaining;
-    bool exportError = false;
-    bool insideTemplate = false; // [FIX] Track template blocks
-    
-    while (getline(ss, line)) {
-        string cleanLine = line;
-        size_t first = cleanLine.find_first_not_of(" \t\r\n");
-        if (first == string::npos) {
-            if (outFile && outFile->is_open()) *outFile << "\n";
-            else if (!exportError) remaining += line + "\n";
-            continue; 
-        }
-        cleanLine.erase(0, first);
-        
-        if (cleanLine.rfind("EXPORT:", 0) == 0) {
-            outFile.reset(); // Cerrar archivo anterior siempre
-            exportError = false; // Resetear estado de error
-            insideTemplate = false; // [FIX] Reset template state
-            
-            string rawArgs = cleanLine.substr(7);
+// [NEW] Streaming export engine. One pass splits the code into EXPORT entries (target path
+// plus the byte range of its body); each file is then rendered in memory, skipped when the
+// bytes on disk are identical (so mtimes, and make/ninja, are left alone) and otherwise
+// written with a single buffered write to a temp file beside the target. All temp files
+// are renamed over their targets at the end, so a crash never leaves half-written sources.
+struct ExportEntry {
+    string fname;
+    fs::path path;
+    string_view sameLine; // Code that followed the filename on the EXPORT line
+    size_t begin, end;    // Body lines, as a byte range of the input
+};
+
+vector<ExportEntry> splitExports(string_view code, const fs::path& basePath, string& remaining) {
+    vector<ExportEntry> entries;
+    bool inExport = false;
+    size_t pos = 0;
+    while (pos < code.size()) {
+        size_t eol = code.find('\n', pos);
+        size_t next = (eol == string_view::npos) ? code.size() : eol + 1;
+        string_view line = code.substr(pos, (eol == string_view::npos ? code.size() : eol) - pos);
+
+        size_t first = line.find_first_not_of(" \t\r\n");
+        if (first != string_view::npos && line.substr(first).rfind("EXPORT:", 0) == 0) {
+            if (inExport) entries.back().end = pos;
+            inExport = false;
+
+            string_view rawArgs = line.substr(first + 7);
             string fname;
-            string sameLineCode;
+            string_view sameLineCode;
 
             // [FIX] Robust filename parsing: Find FIRST pair of quotes, not last
             size_t q1 = rawArgs.find_first_of("\"'");
-            if (q1 != string::npos) {
+            if (q1 != string_view::npos) {
                 char quote = rawArgs[q1];
                 size_t q2 = rawArgs.find(quote, q1 + 1); 
-                if (q2 != string::npos) {
-                    fname = rawArgs.substr(q1 + 1, q2 - q1 - 1);
+                if (q2 != string_view::npos) {
+                    fname = string(rawArgs.substr(q1 + 1, q2 - q1 - 1));
                     // Capture content after the filename (e.g. code generated on same line)
-                    if (q2 + 1 < rawArgs.length()) {
-                        sameLineCode = rawArgs.substr(q2 + 1);
-                    }
+                    sameLineCode = rawArgs.substr(q2 + 1);
                 } else {
-                    fname = rawArgs.substr(q1 + 1); // Unmatched quote fallback
+                    fname = string(rawArgs.substr(q1 + 1)); // Unmatched quote fallback
                 }
             } else {
                 // No quotes, take first word
-                stringstream fss(rawArgs);
-                fss >> fname;
-                // Capture remainder
-                size_t fPos = rawArgs.find(fname);
-                if (fPos != string::npos) {
-                    size_t afterFname = fPos + fname.length();
-                    if (afterFname < rawArgs.length()) sameLineCode = rawArgs.substr(afterFname);
+                size_t w = rawArgs.find_first_not_of(" \t\r\n");
+                if (w != string_view::npos) {
+                    size_t wEnd = rawArgs.find_first_of(" \t\r\n", w);
+                    fname = string(rawArgs.substr(w, wEnd == string_view::npos ? string_view::npos : wEnd - w));
+                    if (wEnd != string_view::npos) sameLineCode = rawArgs.substr(wEnd);
                 }
             }
             
@@ -991,43 +2608,147 @@ string processExports(const string& code, const fs::path& basePath) {
             size_t last = fname.find_last_not_of(" \t\r\n");
             if (last != string::npos) fname.erase(last + 1);
 
-            if (fname.empty() || fname == "END") {
-                continue;
+            if (!fname.empty() && fname != "END") {
+                if (sameLineCode.find_first_not_of(" \t\r\n") == string_view::npos) sameLineCode = {};
+                entries.push_back({fname, basePath / fname, sameLineCode, next, next});
+                inExport = true;
             }
+        } else if (!inExport) {
+            remaining.append(line);
+            remaining += '\n';
+        }
+        pos = next;
+    }
+    if (inExport) entries.back().end = code.size();
+    return entries;
+}
 
-            fs::path path = basePath / fname;
-            try {
-                if (path.has_parent_path()) {
-                    if (!fs::exists(path.parent_path())) cout << "[EXPORT] Creating directory: " << path.parent_path().string() << endl;
-                    fs::create_directories(path.parent_path());
-                }
-                outFile = make_unique<ofstream>(path);
-                if (outFile->is_open()) {
-                    cout << "[EXPORT] Writing to " << fname << "..." << endl;
-                    // Write content found on the same line (if any non-whitespace)
-                    if (!sameLineCode.empty() && sameLineCode.find_first_not_of(" \t\r\n") != string::npos) {
-                        *outFile << sameLineCode << "\n";
-                    }
-                } else {
-                    cerr << "[ERROR] Could not open " << fname << " for writing." << endl;
-                    outFile.reset();
-                    exportError = true; // Activar modo "sumidero"
-                }
-            } catch (const fs::filesystem_error& e) {
-                cerr << "[ERROR] Filesystem error: " << e.what() << endl;
-                outFile.reset();
-                exportError = true; // Activar modo "sumidero"
-            }
-        } else {
-            if (outFile && outFile->is_open()) {
-                // [FIX] Robust template handling via helper
-                string cleanContent = stripTemplates(line, insideTemplate);
-                if (!cleanContent.empty()) {
-                    *outFile << cleanContent << "\n";
-                }
-            } else if (!exportError) {
-                remaining += line + "\n";
-            }
+// Applies the per-line export rules (template stripping, blank lines) to one entry
+string renderExport(string_view code, const ExportEntry& entry) {
+    string out;
+    out.reserve(entry.end - entry.begin + entry.sameLine.size() + 1);
+    if (!entry.sameLine.empty()) { out.append(entry.sameLine); out += '\n'; }
+
+    bool insideTemplate = false; // [FIX] Track template blocks
+    string line;
+    size_t pos = entry.begin;
+    while (pos < entry.end) {
+        size_t eol = code.find('\n', pos);
+        if (eol == string_view::npos || eol > entry.end) eol = entry.end;
+        line.assign(code.data() + pos, eol - pos);
+        pos = eol + 1;
+
+        if (line.find_first_not_of(" \t\r\n") == string::npos) { out += '\n'; continue; }
+        // [FIX] Robust template handling via helper
+        string cleanContent = stripTemplates(line, insideTemplate);
+        if (!cleanContent.empty()) { out += cleanContent; out += '\n'; }
+    }
+    return out;
+}
+
+bool sameFileContent(const fs::path& path, const string& content) {
+    std::error_code ec;
+    if (!fs::is_regular_file(path, ec) || fs::file_size(path, ec) != content.size() || ec) return false;
+    ifstream in(path, ios::binary);
+    string buf(min<size_t>(content.size(), 1 << 16), '\0');
+    size_t off = 0;
+    while (off < content.size()) {
+        size_t n = min(buf.size(), content.size() - off);
+        if (!in.read(&buf[0], n) || content.compare(off, n, buf.data(), n) != 0) return false;
+        off += n;
+    }
+    return true;
+}
+
+// Writes the rendered file to a temp file next to its target. Runs on export workers, so
+// it reports through the result instead of printing.
+struct ExportResult {
+    enum Status { WRITTEN, UNCHANGED, FAILED } status = FAILED;
+    string tempPath;
+    fs::path target; // [FIX] File the temp file replaces: the export path with symlinks followed
+    string error;
+};
+
+ExportResult stageExport(const ExportEntry& entry, const string& content) {
+    ExportResult r;
+    try {
+        if (sameFileContent(entry.path, content)) { r.status = ExportResult::UNCHANGED; return r; }
+        // [FIX] Write through symlinks, so the rename replaces the link's target and not the link
+        r.target = entry.path;
+        for (int hop = 0; hop < 40 && fs::is_symlink(r.target); hop++) {
+            fs::path link = fs::read_symlink(r.target);
+            r.target = link.is_absolute() ? link : r.target.parent_path() / link;
+        }
+        r.tempPath = makeTempName(r.target.string() + ".yori", ".tmp");
+        ofstream out(r.tempPath, ios::binary);
+        if (!out.is_open()) { r.error = "Could not open " + entry.fname + " for writing."; return r; }
+        out.write(content.data(), content.size());
+        out.close();
+        if (!out) {
+            std::error_code ec;
+            fs::remove(r.tempPath, ec);
+            r.error = "Could not write " + entry.fname + ".";
+            return r;
+        }
+        // [FIX] A rewritten file keeps its mode (e.g. an executable script)
+        std::error_code ec;
+        fs::file_status old = fs::status(r.target, ec);
+        if (!ec && fs::exists(old)) fs::permissions(r.tempPath, old.permissions(), ec);
+        r.status = ExportResult::WRITTEN;
+    } catch (const fs::filesystem_error& e) {
+        r.error = string("Filesystem error: ") + e.what();
+    }
+    return r;
+}
+
+// [NEW] Large -make outputs are materialized by a pool of workers. Directories are created
+// once each up front, and an EXPORT repeated for the same path keeps only its last block.
+// `only`, when given, limits the export to those files (make-mode repair passes)
+string processExports(string_view code, const fs::path& basePath, unsigned threads = 0, const set<string>* only = nullptr) {
+    string remaining;
+    vector<ExportEntry> entries = splitExports(code, basePath, remaining);
+
+    set<fs::path> seen, dirs;
+    vector<ExportEntry> unique;
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        if (only && !only->count(fs::path(it->fname).lexically_normal().generic_string())) {
+            cout << "[EXPORT] Ignoring " << it->fname << " (not under repair)" << endl;
+            continue;
+        }
+        if (seen.insert(it->path.lexically_normal()).second) unique.push_back(*it);
+    }
+    reverse(unique.begin(), unique.end());
+    for (const auto& e : unique) if (e.path.has_parent_path()) dirs.insert(e.path.parent_path());
+
+    set<fs::path> badDirs;
+    for (const auto& dir : dirs) {
+        std::error_code ec;
+        if (fs::exists(dir, ec)) continue;
+        cout << "[EXPORT] Creating directory: " << dir.string() << endl;
+        fs::create_directories(dir, ec);
+        if (ec) { cerr << "[ERROR] Filesystem error: " << ec.message() << " [" << dir.string() << "]" << endl; badDirs.insert(dir); }
+    }
+
+    vector<ExportResult> results(unique.size());
+    parallelFor(unique.size(), [&](size_t i) {
+        if (unique[i].path.has_parent_path() && badDirs.count(unique[i].path.parent_path())) return;
+        results[i] = stageExport(unique[i], renderExport(code, unique[i]));
+    }, threads);
+
+    // Report and swap the files in, in input order
+    for (size_t i = 0; i < unique.size(); i++) {
+        const ExportResult& r = results[i];
+        if (r.status == ExportResult::UNCHANGED) { cout << "[EXPORT] Unchanged: " << unique[i].fname << endl; continue; }
+        if (r.status == ExportResult::FAILED) { if (!r.error.empty()) cerr << "[ERROR] " << r.error << endl; continue; }
+        cout << "[EXPORT] Writing to " << unique[i].fname << "..." << endl;
+    }
+    for (size_t i = 0; i < unique.size(); i++) {
+        if (results[i].status != ExportResult::WRITTEN) continue;
+        std::error_code ec;
+        fs::rename(results[i].tempPath, results[i].target, ec);
+        if (ec) {
+            cerr << "[ERROR] Could not replace " << results[i].target.string() << ": " << ec.message() << endl;
+            fs::remove(results[i].tempPath, ec);
         }
     }
     return remaining;
@@ -1054,12 +2775,24 @@ set<string> extractDependencies(const string& code) {
     return deps;
 }
 
-bool preFlightCheck(const set<string>& deps) {
-    if (deps.empty()) return true;
+// [NEW] The probe compile is split from its reporting so it can run in the background,
+// concurrently with the toolchain check and the first generation request.
+struct PreFlightResult {
+    bool ran = false;
+    CmdResult res{"", 0};
+};
+
+bool preFlightNeeded(const set<string>& deps) {
+    if (deps.empty()) return false;
     // If no check command is defined and it's not C/C++, skip check
-    if (CURRENT_LANG.checkCmd.empty() && CURRENT_LANG.id != "cpp" && CURRENT_LANG.id != "c") return true; 
+    if (CURRENT_LANG.checkCmd.empty() && CURRENT_LANG.id != "cpp" && CURRENT_LANG.id != "c") return false; 
+    return true;
+}
+
+PreFlightResult runPreFlight(const set<string>& deps) {
+    PreFlightResult result;
+    if (!preFlightNeeded(deps)) return result;
 
-    cout << "[CHECK] Verifying dependencies locally..." << endl;
     string tempCheck = "temp_dep_check" + CURRENT_LANG.extension;
     ofstream out(tempCheck);
     
@@ -1082,12 +2815,23 @@ bool preFlightCheck(const set<string>& deps) {
     } else {
         cmd = CURRENT_LANG.buildCmd + " -c \"" + tempCheck + "\""; 
     }
-    CmdResult res = execCmd(cmd);
+    {
+        FileLock slot;
+        acquireCompileSlot(slot);
+        result.res = execCmd(cmd);
+    }
+    result.ran = true;
     
-    fs::remove(tempCheck);
-    if (fs::exists(stripExt(tempCheck) + ".o")) fs::remove(stripExt(tempCheck) + ".o");
-    if (fs::exists(stripExt(tempCheck) + ".obj")) fs::remove(stripExt(tempCheck) + ".obj");
+    std::error_code ec;
+    fs::remove(tempCheck, ec);
+    fs::remove(stripExt(tempCheck) + ".o", ec);
+    fs::remove(stripExt(tempCheck) + ".obj", ec);
+    return result;
+}
 
+bool reportPreFlight(const set<string>& deps, const PreFlightResult& result) {
+    if (!result.ran) return true;
+    const CmdResult& res = result.res;
     if (res.exitCode != 0) {
         cout << "   [!] Missing Dependency Detected!" << endl;
         for(const auto& d : deps) {
@@ -1102,49 +2846,2692 @@ bool preFlightCheck(const set<string>& deps) {
         } else {
              cout << "   [ERROR LOG]:\n" << res.output.substr(0, 300) << endl;
         }
-        return false;
+        return false;
+    }
+    cout << "   [OK] Dependencies verified." << endl;
+    return true;
+}
+
+bool preFlightCheck(const set<string>& deps) {
+    if (preFlightNeeded(deps)) cout << "[CHECK] Verifying dependencies locally..." << endl;
+    return reportPreFlight(deps, runPreFlight(deps));
+}
+
+// --- PRE-COMPILE VALIDATION ---
+// [NEW] Cheap structural checks that reject obviously broken candidates before
+// paying for a compiler invocation. Each check returns a targeted correction.
+bool isBraceLanguage(const string& id) {
+    static const set<string> ids = {"cpp", "c", "rust", "go", "cs", "java", "js", "ts", "swift", "kt",
+                                    "scala", "dart", "zig", "php", "groovy", "jsx", "tsx"};
+    return ids.count(id) > 0;
+}
+
+string checkFenceResidue(const string& code) {
+    size_t pos = 0;
+    int line = 1;
+    while (pos < code.length()) {
+        size_t eol = code.find('\n', pos);
+        if (eol == string::npos) eol = code.length();
+        size_t first = code.find_first_not_of(" \t", pos);
+        if (first != string::npos && first < eol && code.compare(first, 3, "```") == 0) {
+            return "Line " + to_string(line) + " contains a markdown fence (```). Return raw source code only, without markdown.";
+        }
+        pos = eol + 1;
+        line++;
+    }
+    return "";
+}
+
+string checkMarkerIntegrity(const string& code) {
+    const string startTag = "// YORI_BLOCK_START: ";
+    const string endTag = "// YORI_BLOCK_END: ";
+    map<string, int> balance;
+    for (const string* tag : {&startTag, &endTag}) {
+        size_t pos = 0;
+        while ((pos = code.find(*tag, pos)) != string::npos) {
+            // Markers are only meaningful at the start of a line
+            size_t lineStart = code.find_last_of('\n', pos == 0 ? 0 : pos - 1);
+            lineStart = (lineStart == string::npos || pos == 0) ? 0 : lineStart + 1;
+            if (code.find_first_not_of(" \t", lineStart) != pos) { pos += tag->length(); continue; }
+            size_t idStart = pos + tag->length();
+            size_t idEnd = code.find('\n', idStart);
+            if (idEnd == string::npos) idEnd = code.length();
+            string id = code.substr(idStart, idEnd - idStart);
+            id.erase(0, id.find_first_not_of(" \t\r"));
+            id.erase(id.find_last_not_of(" \t\r") + 1);
+            balance[id] += (tag == &startTag) ? 1 : -1;
+            pos = idEnd;
+        }
+    }
+    for (const auto& [id, count] : balance) {
+        if (count > 0) return "Container marker '// YORI_BLOCK_END: " + id + "' is missing. Keep every YORI_BLOCK_START/YORI_BLOCK_END pair intact.";
+        if (count < 0) return "Container marker '// YORI_BLOCK_START: " + id + "' is missing. Keep every YORI_BLOCK_START/YORI_BLOCK_END pair intact.";
+    }
+    return "";
+}
+
+// A '/' at pos starts a JS regex literal (not a division) when the previous token cannot end an
+// operand: start of input, an operator or opening bracket, or a keyword such as 'return'.
+bool regexAllowed(const string& code, size_t pos) {
+    size_t k = pos;
+    while (k > 0 && isspace((unsigned char)code[k - 1])) k--;
+    if (k == 0) return true;
+    char prev = code[k - 1];
+    if (isalnum((unsigned char)prev) || prev == '_' || prev == '$') {
+        size_t start = k;
+        while (start > 0 && (isalnum((unsigned char)code[start - 1]) || code[start - 1] == '_' || code[start - 1] == '$')) start--;
+        static const set<string> keywords = {"return", "typeof", "case", "in", "of", "delete", "void", "throw", "new",
+                                             "instanceof", "yield", "await", "else", "do"};
+        return keywords.count(code.substr(start, k - start)) > 0;
+    }
+    return string_view("(,=:[!&|?{};+-*%<>~^").find(prev) != string_view::npos;
+}
+
+// Skips comments, strings and char literals so only structural brackets are counted.
+string checkBalancedBrackets(const string& code, const string& langId) {
+    bool hashComments = (langId == "php");
+    bool quoteIsString = (langId == "js" || langId == "ts" || langId == "jsx" || langId == "tsx" ||
+                          langId == "php" || langId == "groovy" || langId == "dart");
+    bool backtickIsString = (langId == "js" || langId == "ts" || langId == "jsx" || langId == "tsx" || langId == "go");
+    bool regexLiterals = (langId == "js" || langId == "ts" || langId == "jsx" || langId == "tsx");
+
+    vector<pair<char, int>> stack;
+    int line = 1;
+    size_t i = 0, n = code.length();
+    while (i < n) {
+        char c = code[i];
+        if (c == '\n') { line++; i++; continue; }
+
+        if (c == '/' && i + 1 < n && code[i+1] == '/') { i = code.find('\n', i); if (i == string::npos) i = n; continue; }
+        if (hashComments && c == '#') { i = code.find('\n', i); if (i == string::npos) i = n; continue; }
+        if (c == '/' && i + 1 < n && code[i+1] == '*') {
+            size_t end = code.find("*/", i + 2);
+            if (end == string::npos) return "Unterminated block comment starting at line " + to_string(line) + ". The output appears truncated; return the complete file.";
+            line += count(code.begin() + i, code.begin() + end, '\n');
+            i = end + 2; continue;
+        }
+        // C++ raw strings: R"delim( ... )delim"
+        if (langId == "cpp" && c == 'R' && i + 1 < n && code[i+1] == '"' && (i == 0 || !isalnum((unsigned char)code[i-1]))) {
+            size_t paren = code.find('(', i + 2);
+            if (paren != string::npos) {
+                string closer = ")" + code.substr(i + 2, paren - i - 2) + "\"";
+                size_t end = code.find(closer, paren + 1);
+                if (end == string::npos) return "Unterminated raw string literal at line " + to_string(line) + ". The output appears truncated; return the complete file.";
+                line += count(code.begin() + i, code.begin() + end, '\n');
+                i = end + closer.length(); continue;
+            }
+        }
+        // [FIX] C# verbatim strings: @"C:\dir\" ("" is the only escape), also $@"..." / @$"..."
+        if (langId == "cs" && (c == '@' || c == '$')) {
+            size_t q = i + 1;
+            if (q < n && (code[q] == '@' || code[q] == '$') && code[q] != c) q++;
+            bool verbatim = (c == '@' || code[i+1] == '@');
+            if (verbatim && q < n && code[q] == '"' && !(q + 2 < n && code[q+1] == '"' && code[q+2] == '"')) {
+                size_t j = q + 1;
+                while (j < n && !(code[j] == '"' && (j + 1 >= n || code[j+1] != '"'))) j += (code[j] == '"') ? 2 : 1;
+                if (j >= n) return ""; // Not sure where it ends: skip the check rather than reject
+                line += count(code.begin() + i, code.begin() + j, '\n');
+                i = j + 1; continue;
+            }
+        }
+        // [FIX] Text blocks and raw strings: """...""" (kt, java, swift, scala, groovy, dart, cs),
+        // ''' in groovy/dart, Rust r"..." / r#"..."# and Swift #"..."#
+        bool tripleQuotes = (langId == "kt" || langId == "java" || langId == "swift" || langId == "scala" ||
+                             langId == "groovy" || langId == "dart" || langId == "cs");
+        if (tripleQuotes && (c == '"' || (c == '\'' && quoteIsString)) && i + 2 < n && code[i+1] == c && code[i+2] == c) {
+            size_t q = i;
+            while (q < n && code[q] == c) q++;
+            size_t run = q - i;
+            bool escapes = (langId == "java" || langId == "swift" || langId == "groovy" || langId == "dart");
+            size_t j = q;
+            bool closed = false;
+            while (j < n && !closed) {
+                if (escapes && code[j] == '\\') { j += 2; continue; }
+                if (code[j] != c) { j++; continue; }
+                size_t k = j;
+                while (k < n && code[k] == c) k++;
+                closed = (k - j >= run); // Kotlin/Scala allow extra quotes before the closer
+                j = k;
+            }
+            if (!closed) return "";
+            line += count(code.begin() + i, code.begin() + j, '\n');
+            i = j; continue;
+        }
+        if ((langId == "rust" && (c == 'r' || (c == 'b' && i + 1 < n && code[i+1] == 'r')) && (i == 0 || !(isalnum((unsigned char)code[i-1]) || code[i-1] == '_'))) ||
+            (langId == "swift" && c == '#')) {
+            size_t q = i + (c == 'b' ? 2 : (c == 'r' ? 1 : 0));
+            size_t hashes = 0;
+            while (q < n && code[q] == '#') { q++; hashes++; }
+            if (q < n && code[q] == '"' && (langId == "rust" || hashes > 0)) {
+                string closer = "\"" + string(hashes, '#');
+                size_t end = code.find(closer, q + 1);
+                if (end == string::npos) return "";
+                line += count(code.begin() + i, code.begin() + end, '\n');
+                i = end + closer.length(); continue;
+            }
+        }
+        if (c == '"' || (c == '`' && backtickIsString) || (c == '\'' && quoteIsString)) {
+            size_t j = i + 1;
+            while (j < n && code[j] != c) {
+                if (code[j] == '\\') j++;
+                else if (code[j] == '\n') {
+                    if (c != '`') break; // Plain strings cannot span lines
+                    line++;
+                }
+                j++;
+            }
+            if (j >= n) return "Unterminated string literal at line " + to_string(line) + ". The output appears truncated; return the complete file.";
+            i = j + 1; continue;
+        }
+        if (c == '\'') {
+            // Char literal: one code point or one escape ('a', '\n', '\x41', '\u{1F600}') before the
+            // closing quote. Anything else (Rust lifetimes, digit separators) is skipped as-is.
+            size_t j = i + 1;
+            if (j < n && code[j] == '\\') {
+                j++;
+                if (j < n && code[j] == 'u' && j + 1 < n && code[j + 1] == '{') {
+                    size_t close = code.find('}', j);
+                    j = (close != string::npos && close < j + 10) ? close + 1 : n;
+                } else if (j < n && (code[j] == 'x' || code[j] == 'u' || code[j] == 'U' || isdigit((unsigned char)code[j]))) {
+                    j++;
+                    while (j < n && j < i + 12 && isxdigit((unsigned char)code[j])) j++;
+                } else {
+                    j++;
+                }
+            } else if (j < n && code[j] != '\'' && code[j] != '\n') {
+                j++;
+                while (j < n && ((unsigned char)code[j] & 0xC0) == 0x80) j++; // Rest of a UTF-8 sequence
+            }
+            if (j < n && code[j] == '\'') { i = j + 1; continue; }
+            i++; continue;
+        }
+        // JS/TS regex literal (/\(/g): a '/' where an operand is expected, closed on the same line
+        if (c == '/' && regexLiterals && regexAllowed(code, i)) {
+            size_t j = i + 1;
+            bool inClass = false;
+            while (j < n && code[j] != '\n' && (inClass || code[j] != '/')) {
+                if (code[j] == '\\') j++;
+                else if (code[j] == '[') inClass = true;
+                else if (code[j] == ']') inClass = false;
+                j++;
+            }
+            if (j < n && code[j] == '/') {
+                i = j + 1;
+                while (i < n && isalpha((unsigned char)code[i])) i++; // Flags
+                continue;
+            }
+        }
+
+        if (c == '{' || c == '(' || c == '[') stack.push_back({c, line});
+        else if (c == '}' || c == ')' || c == ']') {
+            char open = (c == '}') ? '{' : (c == ')' ? '(' : '[');
+            if (stack.empty()) return string("Unexpected '") + c + "' at line " + to_string(line) + " with no matching opener.";
+            if (stack.back().first != open) {
+                return string("Mismatched '") + c + "' at line " + to_string(line) + " (opened with '" + stack.back().first + "' at line " + to_string(stack.back().second) + ").";
+            }
+            stack.pop_back();
+        }
+        i++;
+    }
+    if (!stack.empty()) {
+        return string("Unclosed '") + stack.back().first + "' opened at line " + to_string(stack.back().second) + ". The output appears truncated; return the complete file.";
+    }
+    return "";
+}
+
+// Detects the common failure of answering a C-family target with Python (and vice versa).
+string checkLanguageSignature(const string& code, const LangProfile& lang) {
+    int pyScore = 0, cScore = 0;
+    stringstream ss(code);
+    string line;
+    while (getline(ss, line)) {
+        size_t first = line.find_first_not_of(" \t");
+        if (first == string::npos) continue;
+        size_t last = line.find_last_not_of(" \t\r");
+        string t = line.substr(first, last - first + 1);
+        bool endsColon = !t.empty() && t.back() == ':';
+        bool hasSemi = t.find(';') != string::npos;
+
+        if (t.rfind("def ", 0) == 0 && endsColon) pyScore += 2;
+        else if ((t.rfind("elif ", 0) == 0 || t.rfind("else:", 0) == 0) && endsColon) pyScore++;
+        else if (t.rfind("if __name__", 0) == 0) pyScore += 2;
+        // [FIX] Go imports are quoted paths ("import \"fmt\"", "import f \"fmt\"", "import (")
+        else if (t.rfind("import ", 0) == 0 && !hasSemi && t.find('"') == string::npos && t.back() != '(') pyScore++;
+        else if (t.rfind("from ", 0) == 0 && t.find(" import ") != string::npos && !hasSemi) pyScore++;
+        else if (t.rfind("print(", 0) == 0 && !hasSemi) pyScore++;
+
+        if (t.rfind("#include", 0) == 0) cScore += 2;
+        else if (t.find("int main(") != string::npos) cScore += 2;
+        else if (t.find("std::") != string::npos) cScore++;
+        else if (hasSemi && t.back() == ';') cScore++;
+    }
+
+    bool cFamily = (lang.id == "cpp" || lang.id == "c" || lang.id == "java" || lang.id == "cs" || lang.id == "rust" || lang.id == "go");
+    if (cFamily && pyScore >= 2 && pyScore > cScore) {
+        return "FATAL: It seems you wrote Python code instead of " + lang.name + ". STOP. Return ONLY valid " + lang.name + " code.";
+    }
+    if (lang.id == "py" && cScore >= 4 && cScore > pyScore * 2) {
+        return "FATAL: It seems you wrote C/C++ code instead of Python. STOP. Return ONLY valid Python code.";
+    }
+    return "";
+}
+
+string validateCandidate(const string& code, const LangProfile& lang, bool multiFile) {
+    if (code.find_first_not_of(" \t\r\n") == string::npos) return "The output was empty. Return the complete source file.";
+
+    string issue = checkMarkerIntegrity(code);
+    if (!issue.empty()) return issue;
+    // Multi-file projects may legitimately export markdown and other languages
+    if (multiFile) return "";
+
+    issue = checkFenceResidue(code);
+    if (!issue.empty()) return issue;
+    issue = checkLanguageSignature(code, lang);
+    if (!issue.empty()) return issue;
+    if (isBraceLanguage(lang.id)) issue = checkBalancedBrackets(code, lang.id);
+    return issue;
+}
+
+// --- COMPILE SERVER ---
+// Resident JVM worker: reads one tab-separated argument list per line and answers with the
+// compiler output followed by a sentinel line carrying the exit code.
+const char* COMPILE_WORKER_SOURCE = R"JAVA(import java.io.*;
+import java.lang.reflect.Method;
+import javax.tools.*;
+
+public class YoriCompileWorker {
+    public static void main(String[] argv) throws Exception {
+        boolean kotlin = argv.length > 0 && argv[0].equals("kotlinc");
+        BufferedReader in = new BufferedReader(new InputStreamReader(System.in, "UTF-8"));
+        PrintStream out = new PrintStream(new FileOutputStream(FileDescriptor.out), true, "UTF-8");
+        JavaCompiler javac = kotlin ? null : ToolProvider.getSystemJavaCompiler();
+        Object k2jvm = null;
+        Method exec = null;
+        out.println("\u0001YORI_READY");
+        String line;
+        while ((line = in.readLine()) != null) {
+            if (line.isEmpty()) continue;
+            String[] args = line.split("\t");
+            ByteArrayOutputStream buf = new ByteArrayOutputStream();
+            PrintStream ps = new PrintStream(buf, true, "UTF-8");
+            int code;
+            try {
+                if (kotlin) {
+                    if (k2jvm == null) {
+                        Class<?> c = Class.forName("org.jetbrains.kotlin.cli.jvm.K2JVMCompiler");
+                        k2jvm = c.getDeclaredConstructor().newInstance();
+                        exec = c.getMethod("exec", PrintStream.class, String[].class);
+                    }
+                    code = ((Enum<?>) exec.invoke(k2jvm, ps, (Object) args)).ordinal();
+                } else {
+                    code = javac.run(null, ps, ps, args);
+                }
+            } catch (Throwable t) {
+                t.printStackTrace(ps);
+                code = 2;
+            }
+            out.print(buf.toString("UTF-8"));
+            out.println("\u0001YORI_EXIT:" + code);
+        }
+    }
+}
+)JAVA";
+
+struct CompileWorker {
+    #ifndef _WIN32
+    pid_t pid = -1;
+    int toChild = -1;
+    int fromChild = -1;
+    #endif
+    bool broken = false;
+    string pending; // Bytes read past the last sentinel
+};
+
+map<string, CompileWorker> COMPILE_WORKERS;
+set<string> STARTED_COMPILE_SERVERS;
+mutex COMPILE_SERVER_MUTEX;
+
+void stopCompileServers() {
+    lock_guard<mutex> lock(COMPILE_SERVER_MUTEX);
+    #ifndef _WIN32
+    for (auto& [id, w] : COMPILE_WORKERS) {
+        if (w.pid <= 0) continue;
+        close(w.toChild); // EOF on stdin ends the worker loop
+        close(w.fromChild);
+        int status = 0;
+        for (int i = 0; i < 20 && waitpid(w.pid, &status, WNOHANG) == 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        if (waitpid(w.pid, &status, WNOHANG) == 0) { kill(-w.pid, SIGKILL); waitpid(w.pid, &status, 0); }
+    }
+    #endif
+    COMPILE_WORKERS.clear();
+    for (const auto& id : STARTED_COMPILE_SERVERS) {
+        if (COMPILE_SERVERS.count(id) && !COMPILE_SERVERS[id].stop.empty()) execCmd(COMPILE_SERVERS[id].stop);
+    }
+    STARTED_COMPILE_SERVERS.clear();
+}
+
+// Reads until the next sentinel line; returns false on EOF/timeout.
+#ifndef _WIN32
+bool readWorkerReply(CompileWorker& w, const string& tag, string& body, int timeoutMs) {
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+    char chunk[4096];
+    while (true) {
+        size_t pos = w.pending.find("\x01" + tag);
+        if (pos != string::npos) {
+            size_t eol = w.pending.find('\n', pos);
+            if (eol != string::npos) {
+                body = w.pending.substr(0, eol + 1);
+                w.pending.erase(0, eol + 1);
+                return true;
+            }
+        }
+        int left = (int)chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        if (left <= 0) return false;
+        pollfd p{w.fromChild, POLLIN, 0};
+        if (poll(&p, 1, left) <= 0) return false;
+        ssize_t n = read(w.fromChild, chunk, sizeof(chunk));
+        if (n <= 0) return false;
+        w.pending.append(chunk, n);
+    }
+}
+
+bool spawnCompileWorker(const LangProfile& lang, CompileWorker& w) {
+    string java = resolveExecutable("java");
+    if (java.empty()) return false;
+    string classPath;
+    if (lang.id == "kt") {
+        // kotlinc lives in <home>/bin; the compiler jars in <home>/lib
+        string kotlinc = resolveExecutable(lang.buildCmd.substr(0, lang.buildCmd.find(' ')));
+        if (kotlinc.empty()) return false;
+        fs::path lib = fs::canonical(kotlinc).parent_path().parent_path() / "lib";
+        if (!fs::exists(lib / "kotlin-compiler.jar")) return false;
+        classPath = (lib / "*").string();
+    }
+
+    std::error_code ec;
+    fs::create_directories(CACHE_DIR, ec);
+    string source = CACHE_DIR + "/YoriCompileWorker.java";
+    { ofstream f(source); f << COMPILE_WORKER_SOURCE; }
+
+    vector<string> args = {java};
+    if (!classPath.empty()) { args.push_back("-cp"); args.push_back(classPath); }
+    args.push_back(source); // Single-file source launch (JDK 11+)
+    args.push_back(lang.id == "kt" ? "kotlinc" : "javac");
+    // Built before fork(): the child of a multithreaded process must not allocate
+    vector<char*> argv;
+    for (auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+
+    int in[2], out[2];
+    if (cloexecPipe(in) != 0) return false;
+    if (cloexecPipe(out) != 0) { close(in[0]); close(in[1]); return false; }
+    pid_t pid = fork();
+    if (pid < 0) { close(in[0]); close(in[1]); close(out[0]); close(out[1]); return false; }
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(in[0], 0); dup2(out[1], 1); dup2(out[1], 2);
+        close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+        execv(java.c_str(), argv.data());
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    close(in[0]); close(out[1]);
+    w.pid = pid; w.toChild = in[1]; w.fromChild = out[0];
+    return true;
+}
+#endif
+
+// Launches the configured server for a profile ahead of the first verification pass so the
+// JVM boots while the model is still generating.
+void startCompileServer(const LangProfile& lang) {
+    if (!COMPILE_SERVERS.count(lang.id)) return;
+    static bool cleanupRegistered = false;
+    lock_guard<mutex> lock(COMPILE_SERVER_MUTEX);
+    if (!cleanupRegistered) { cleanupRegistered = true; atexit(stopCompileServers); }
+    const CompileServerSpec& spec = COMPILE_SERVERS[lang.id];
+
+    if (spec.mode == "worker") {
+        if (COMPILE_WORKERS.count(lang.id)) return;
+        CompileWorker& w = COMPILE_WORKERS[lang.id];
+        #ifndef _WIN32
+        if (spawnCompileWorker(lang, w)) {
+            log("INFO", "Compile worker started for " + lang.name);
+            return;
+        }
+        #endif
+        w.broken = true;
+        log("WARN", "Compile worker unavailable for " + lang.name + ", using " + lang.buildCmd);
+        return;
+    }
+
+    if (STARTED_COMPILE_SERVERS.count(lang.id)) return;
+    STARTED_COMPILE_SERVERS.insert(lang.id);
+    if (!spec.start.empty()) {
+        CmdResult r = execCmd(spec.start);
+        if (r.exitCode != 0) log("WARN", "Compile server start failed: " + r.output.substr(0, 200));
+    }
+}
+
+// Verification build of a single source file, routed through the compile server when one is
+// enabled. Falls back to spawning the regular build command if the server misbehaves.
+CmdResult runVerifyBuild(const LangProfile& lang, const string& src, const string& bin) {
+    FileLock slot;
+    acquireCompileSlot(slot);
+    string buildCmd = lang.buildCmd;
+    if (COMPILE_SERVERS.count(lang.id)) {
+        startCompileServer(lang);
+        const CompileServerSpec& spec = COMPILE_SERVERS[lang.id];
+        if (spec.mode == "command" && !spec.buildCmd.empty()) buildCmd = spec.buildCmd;
+        #ifndef _WIN32
+        if (spec.mode == "worker") {
+            lock_guard<mutex> lock(COMPILE_SERVER_MUTEX);
+            CompileWorker& w = COMPILE_WORKERS[lang.id];
+            if (!w.broken && w.pid > 0) {
+                // Compiler flags from the build command, then the file
+                string request;
+                stringstream flags(lang.buildCmd.substr(min(lang.buildCmd.size(), lang.buildCmd.find(' '))));
+                string tok;
+                while (flags >> tok) request += tok + "\t";
+                request += src + "\n";
+                string reply;
+                bool ok = write(w.toChild, request.data(), request.size()) == (ssize_t)request.size() &&
+                          readWorkerReply(w, "YORI_EXIT:", reply, 300000);
+                if (ok) {
+                    size_t pos = reply.rfind("\x01YORI_EXIT:");
+                    int code = atoi(reply.c_str() + pos + 11);
+                    string output = reply.substr(0, pos);
+                    // Drop the readiness banner from the first reply
+                    size_t ready = output.find("\x01YORI_READY\n");
+                    if (ready != string::npos) output.erase(ready, 12);
+                    if (VERBOSE_MODE) cout << "   [SERVER] " << lang.name << " worker exit " << code << endl;
+                    return {output, code};
+                }
+                w.broken = true;
+                log("WARN", "Compile worker for " + lang.name + " stopped responding: " + w.pending.substr(0, 300));
+            }
+        }
+        #endif
+    }
+
+    string valCmd = buildCmd + " \"" + src + "\"";
+    if (lang.producesBinary) valCmd += " -o \"" + bin + "\"";
+    return execCmd(valCmd);
+}
+
+// --- BUILD DRIVER ---
+// [NEW] Builds the project exported by -make. CMake projects keep their configured build
+// directory between passes (Ninja when available), make and cmake run with one job per
+// core, and the output is captured and parsed so failures can be fed back to the model.
+struct BuildDiagnostic {
+    string file;
+    int line = 0;
+    int col = 0;
+    string message;
+};
+
+struct BuildOutcome {
+    bool hasBuildScript = false;
+    bool ok = false;
+    string tool;
+    string output;
+    vector<BuildDiagnostic> diagnostics;
+};
+
+// Errors in GCC/Clang (file:line:col: error: msg), MSVC (file(line,col): error C1234: msg)
+// and linker (undefined reference) form
+vector<BuildDiagnostic> parseDiagnostics(const string& output, size_t limit = 30) {
+    vector<BuildDiagnostic> diags;
+    set<string> seen;
+    stringstream ss(output);
+    string line;
+    while (getline(ss, line) && diags.size() < limit) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        BuildDiagnostic d;
+        size_t err = line.find(": error");
+        if (err == string::npos) err = line.find(": fatal error");
+        if (err != string::npos) {
+            string loc = line.substr(0, err);
+            d.message = line.substr(line.find(':', err + 2) == string::npos ? err + 2 : line.find(':', err + 2) + 1);
+            size_t paren = loc.rfind('(');
+            if (paren != string::npos && loc.back() == ')') {
+                // MSVC: file(line,col)
+                d.file = loc.substr(0, paren);
+                sscanf(loc.c_str() + paren + 1, "%d,%d", &d.line, &d.col);
+            } else {
+                // GCC/Clang: file:line[:col] (the drive letter colon on Windows is part of the file)
+                vector<string> parts;
+                size_t start = 0, colon;
+                while ((colon = loc.find(':', start)) != string::npos) { parts.push_back(loc.substr(start, colon - start)); start = colon + 1; }
+                parts.push_back(loc.substr(start));
+                auto isNum = [](const string& s) { return !s.empty() && all_of(s.begin(), s.end(), ::isdigit); };
+                size_t n = parts.size();
+                size_t fileParts = n;
+                if (n >= 3 && isNum(parts[n - 1]) && isNum(parts[n - 2])) { d.line = stoi(parts[n - 2]); d.col = stoi(parts[n - 1]); fileParts = n - 2; }
+                else if (n >= 2 && isNum(parts[n - 1])) { d.line = stoi(parts[n - 1]); fileParts = n - 1; }
+                for (size_t i = 0; i < fileParts; i++) d.file += (i ? ":" : "") + parts[i];
+            }
+        } else if (line.find("undefined reference to") != string::npos || line.find("unresolved external symbol") != string::npos) {
+            d.message = line;
+        } else {
+            continue;
+        }
+        d.message.erase(0, d.message.find_first_not_of(" \t"));
+        if (d.file.find_first_not_of(" \t") == string::npos) d.file.clear();
+        if (seen.insert(d.file + ":" + to_string(d.line) + ":" + d.message).second) diags.push_back(d);
+    }
+    return diags;
+}
+
+string formatDiagnostics(const BuildOutcome& build) {
+    stringstream out;
+    out << "Build (" << build.tool << ") failed";
+    if (build.diagnostics.empty()) {
+        // Nothing parseable: hand over the end of the log, where the failure usually is
+        size_t keep = 3000;
+        out << ":\n" << (build.output.size() > keep ? build.output.substr(build.output.size() - keep) : build.output);
+        return out.str();
+    }
+    out << " with " << build.diagnostics.size() << " error(s):\n";
+    for (const auto& d : build.diagnostics) {
+        if (!d.file.empty()) out << d.file << ":" << d.line << (d.col ? ":" + to_string(d.col) : "") << ": ";
+        out << d.message << "\n";
+    }
+    return out.str();
+}
+
+// [NEW] Make-mode repair: the exported files the diagnostics point at, as normalized project
+// paths. Empty when no error can be pinned on a project file (link/configure errors), which
+// means the whole project is regenerated.
+set<string> filesToRepair(const BuildOutcome& build, const vector<string>& projectFiles) {
+    set<string> targets;
+    for (const auto& d : build.diagnostics) {
+        if (d.file.empty()) continue;
+        std::error_code ec;
+        fs::path diagPath = fs::weakly_canonical(fs::absolute(d.file, ec), ec);
+        for (const auto& f : projectFiles) {
+            std::error_code ec2;
+            fs::path projPath = fs::weakly_canonical(fs::absolute(f, ec2), ec2);
+            if (projPath == diagPath) { targets.insert(f); break; }
+        }
+    }
+    return targets;
+}
+
+BuildOutcome runProjectBuild() {
+    BuildOutcome build;
+    unsigned jobs = max(1u, thread::hardware_concurrency());
+    vector<string> steps;
+    if (fs::exists("Makefile")) {
+        build.tool = "make";
+        steps.push_back("make -j" + to_string(jobs));
+    } else if (fs::exists("CMakeLists.txt")) {
+        build.tool = "cmake";
+        // A configured build directory is reused; cmake --build re-runs configure itself when
+        // CMakeLists.txt changes.
+        if (!fs::exists(fs::path("build") / "CMakeCache.txt")) {
+            string generator = resolveExecutable("ninja").empty() ? "" : " -G Ninja";
+            steps.push_back("cmake -S . -B build" + generator);
+        }
+        steps.push_back("cmake --build build -j " + to_string(jobs));
+    } else if (fs::exists("build.sh")) {
+        build.tool = "build.sh";
+        #ifndef _WIN32
+        steps.push_back("chmod +x build.sh && ./build.sh");
+        #else
+        steps.push_back("bash build.sh");
+        #endif
+    } else if (fs::exists("build.bat")) {
+        build.tool = "build.bat";
+        steps.push_back("build.bat");
+    } else {
+        return build;
+    }
+    build.hasBuildScript = true;
+
+    build.ok = true;
+    for (const auto& step : steps) {
+        cout << "[MAKE] " << step << endl;
+        FileLock slot;
+        acquireCompileSlot(slot);
+        CmdResult res = execCmd(step);
+        build.output += res.output;
+        if (VERBOSE_MODE) cout << res.output;
+        if (res.exitCode != 0) { build.ok = false; break; }
+    }
+    log(build.ok ? "INFO" : "FAIL", "Project build (" + build.tool + "):\n" + build.output.substr(0, 20000));
+    if (!build.ok) build.diagnostics = parseDiagnostics(build.output);
+    return build;
+}
+
+void selectTarget() {
+    string label = "Language";
+    if (CURRENT_MODE == GenMode::MODEL_3D) label = "3D Format";
+    if (CURRENT_MODE == GenMode::IMAGE) label = "Image Format";
+
+    cout << "\n[?] Ambiguous target. Select " << label << ":\n";
+    int i = 1; vector<string> keys;
+    
+    const auto* db = &LANG_DB;
+    if (CURRENT_MODE == GenMode::MODEL_3D) db = &MODEL_DB;
+    else if (CURRENT_MODE == GenMode::IMAGE) db = &IMAGE_DB;
+
+    for(auto const& [key, val] : *db) keys.push_back(key);
+    for(const auto& k : keys) { cout << i++ << ". " << db->at(k).name << " "; if(i%4==0) cout<<endl;}
+    cout << "\n> "; int c; cin >> c; 
+    if(c>=1 && c<=keys.size()) CURRENT_LANG = db->at(keys[c-1]);
+    else CURRENT_LANG = (CURRENT_MODE == GenMode::CODE) ? LANG_DB["cpp"] : (CURRENT_MODE == GenMode::MODEL_3D ? MODEL_DB["obj"] : IMAGE_DB["svg"]);
+}
+
+// --- FIX / EXPLAIN ---
+// [NEW] Large files are processed as chunks split at unit boundaries: a line that follows a
+// blank line, outside comments and strings, at the shallowest nesting level available (so
+// namespace/class bodies are split by member). Each chunk goes to the model with the outline
+// of the file; fix may answer UNCHANGED, in which case the
+// original bytes are kept, and explain replies are checked to still contain the same code.
+enum class ChunkMode { AUTO, ALWAYS, NEVER };
+
+const size_t CHUNK_THRESHOLD_CHARS = 12000; // AUTO chunks files larger than this
+const size_t CHUNK_TARGET_CHARS = 6000;
+
+struct CodeChunk {
+    size_t begin, end;
+};
+
+LangProfile langForFile(const string& file) {
+    string ext = getExt(file);
+    for (auto const& [key, val] : LANG_DB) if (val.extension == ext) return val;
+    return LangProfile{};
+}
+
+// Per-line nesting info: brace depth (brace languages) or indentation (others) at line start
+struct LineInfo {
+    size_t pos;
+    int depth;
+    bool blank;
+    bool quoted; // Starts inside a block comment or multi-line string
+};
+
+vector<LineInfo> scanCodeLines(const string& code, const string& langId) {
+    bool braces = isBraceLanguage(langId);
+    bool hashComments = (langId == "py" || langId == "rb" || langId == "sh" || langId == "pl" || langId == "r" || langId == "jl" || langId == "nim");
+    vector<LineInfo> lines;
+    int depth = 0;
+    bool blockComment = false, tripleQuote = false;
+    size_t pos = 0;
+    while (pos < code.size()) {
+        size_t eol = code.find('\n', pos);
+        if (eol == string::npos) eol = code.size();
+        string_view line(code.data() + pos, eol - pos);
+        bool blank = line.find_first_not_of(" \t\r") == string_view::npos;
+        int indent = 0;
+        for (char c : line) { if (c == ' ') indent++; else if (c == '\t') indent += 4; else break; }
+        lines.push_back({pos, braces ? depth : indent, blank, blockComment || tripleQuote});
+
+        // Track nesting through the line, skipping strings and comments
+        char quote = 0;
+        for (size_t i = 0; i < line.size(); i++) {
+            char c = line[i];
+            if (blockComment) { if (c == '*' && i + 1 < line.size() && line[i + 1] == '/') { blockComment = false; i++; } continue; }
+            if (tripleQuote) { if (line.substr(i, 3) == "\"\"\"" || line.substr(i, 3) == "'''") { tripleQuote = false; i += 2; } continue; }
+            if (quote) { if (c == '\\') i++; else if (c == quote) quote = 0; continue; }
+            if (langId == "py" && (line.substr(i, 3) == "\"\"\"" || line.substr(i, 3) == "'''")) { tripleQuote = true; i += 2; continue; }
+            if (hashComments && c == '#') break;
+            if (braces && c == '/' && i + 1 < line.size() && line[i + 1] == '/') break;
+            if (braces && c == '/' && i + 1 < line.size() && line[i + 1] == '*') { blockComment = true; i++; continue; }
+            if (c == '"' || (c == '\'' && langId != "rust")) { quote = c; continue; }
+            if (braces && c == '{') depth++;
+            if (braces && c == '}' && depth > 0) depth--;
+        }
+        pos = eol + 1;
+    }
+    return lines;
+}
+
+// Splits lines [first, last) into units: candidate starts are non-blank lines after a blank
+// line, at the shallowest nesting level found in the range. Units still over the target are
+// split again one level deeper (class or namespace bodies).
+void splitUnits(const string& code, const vector<LineInfo>& lines, size_t first, size_t last, vector<size_t>& starts, size_t target) {
+    size_t endPos = last < lines.size() ? lines[last].pos : code.size();
+    if (endPos - lines[first].pos <= target) return;
+    int level = INT_MAX;
+    vector<size_t> cands;
+    for (size_t i = first + 1; i < last; i++) {
+        const LineInfo& l = lines[i];
+        if (l.blank || l.quoted || !lines[i - 1].blank) continue;
+        size_t text = code.find_first_not_of(" \t", l.pos);
+        if (string_view(")]}").find(code[text]) != string_view::npos) continue;
+        if (l.depth < level) { level = l.depth; cands.clear(); }
+        if (l.depth == level) cands.push_back(i);
+    }
+    if (cands.empty()) return;
+    cands.push_back(last);
+    size_t from = first;
+    for (size_t c : cands) {
+        splitUnits(code, lines, from, c, starts, target);
+        if (c < last) starts.push_back(lines[c].pos);
+        from = c;
+    }
+}
+
+// Start offsets of top-level units (column 0, brace depth 0); with `nested`, oversized units
+// are broken down further as splitUnits does
+vector<size_t> topLevelBoundaries(const string& code, const string& langId, bool nested = false, size_t target = CHUNK_TARGET_CHARS) {
+    vector<LineInfo> lines = scanCodeLines(code, langId);
+    vector<size_t> starts;
+    if (lines.empty()) return starts;
+    if (nested) {
+        splitUnits(code, lines, 0, lines.size(), starts, target);
+        sort(starts.begin(), starts.end());
+        return starts;
+    }
+    for (size_t i = 1; i < lines.size(); i++) {
+        const LineInfo& l = lines[i];
+        if (!l.blank && !l.quoted && lines[i - 1].blank && l.depth == 0 && !isspace((unsigned char)code[l.pos]) &&
+            string_view(")]}").find(code[l.pos]) == string_view::npos) starts.push_back(l.pos);
+    }
+    return starts;
+}
+
+// Groups units into chunks of roughly `target` chars; a unit is never split
+vector<CodeChunk> splitCodeChunks(const string& code, const string& langId, size_t target = CHUNK_TARGET_CHARS) {
+    vector<size_t> starts = topLevelBoundaries(code, langId, true, target);
+    starts.push_back(code.size());
+    vector<CodeChunk> chunks;
+    size_t begin = 0;
+    for (size_t i = 0; i < starts.size(); i++) {
+        size_t s = starts[i];
+        size_t next = (i + 1 < starts.size()) ? starts[i + 1] : s;
+        // Close the chunk before adding the next unit would push it past the target
+        if (s == code.size() || (s > begin && next - begin > target)) {
+            if (s > begin) chunks.push_back({begin, s});
+            begin = s;
+        }
+    }
+    if (chunks.empty()) chunks.push_back({0, code.size()});
+    return chunks;
+}
+
+// First code line of the unit starting at pos (comments, attributes and blank lines skipped)
+string unitSignature(const string& code, size_t pos, const string& langId) {
+    while (pos < code.size()) {
+        size_t eol = code.find('\n', pos);
+        if (eol == string::npos) eol = code.size();
+        string line = code.substr(pos, eol - pos);
+        line.erase(0, line.find_first_not_of(" \t"));
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+        pos = eol + 1;
+        if (line.empty() || line.rfind("//", 0) == 0 || line.rfind("/*", 0) == 0 || line.rfind("*", 0) == 0 ||
+            (line[0] == '#' && langId != "c" && langId != "cpp") || line[0] == '@') continue;
+        return line.substr(0, 160);
+    }
+    return "";
+}
+
+// First code line of every top-level unit: the shared context each chunk sees
+string codeOutline(const string& code, const string& langId) {
+    string outline;
+    vector<size_t> starts = topLevelBoundaries(code, langId);
+    starts.insert(starts.begin(), 0);
+    for (size_t s : starts) {
+        string sig = unitSignature(code, s, langId);
+        if (!sig.empty()) outline += sig + "\n";
+    }
+    return outline;
+}
+
+// End (one past the closing quote) of the Python string literal opening at pos
+size_t pyStringEnd(string_view code, size_t pos) {
+    char q = code[pos];
+    bool triple = code.substr(pos, 3) == string(3, q);
+    size_t i = pos + (triple ? 3 : 1);
+    while (i < code.size()) {
+        if (code[i] == '\\') { i += 2; continue; }
+        if (!triple && code[i] == '\n') return i;
+        if (code[i] == q && (!triple || code.substr(i, 3) == string(3, q))) return i + (triple ? 3 : 1);
+        i++;
+    }
+    return code.size();
+}
+
+// Code with comments and whitespace removed, to check an explain reply kept the code intact.
+// Python docstrings (a string literal alone on its line) count as comments.
+// Empty when the language's comment syntax is not known.
+string codeSkeleton(string_view code, const string& langId) {
+    bool slashes = isBraceLanguage(langId);
+    bool hashes = (langId == "py" || langId == "rb" || langId == "sh" || langId == "pl" || langId == "r" || langId == "jl" || langId == "nim");
+    if (!slashes && !hashes) return "";
+    string out;
+    out.reserve(code.size());
+    char quote = 0;
+    bool lineStart = true; // Only whitespace so far on this line
+    for (size_t i = 0; i < code.size(); i++) {
+        char c = code[i];
+        if (langId == "py" && lineStart && !quote) {
+            size_t q = i;
+            while (q < i + 2 && q < code.size() && strchr("rRuUbBfF", code[q])) q++; // String prefix
+            if (q < code.size() && (code[q] == '"' || code[q] == '\'')) {
+                size_t end = pyStringEnd(code, q);
+                size_t k = end;
+                while (k < code.size() && (code[k] == ' ' || code[k] == '\t' || code[k] == '\r')) k++;
+                if (k >= code.size() || code[k] == '\n' || code[k] == '#') { i = k - 1; continue; }
+            }
+        }
+        if (c == '\n') lineStart = true;
+        else if (!isspace((unsigned char)c)) lineStart = false;
+        if (quote) { out += c; if (c == '\\' && i + 1 < code.size()) out += code[++i]; else if (c == quote) quote = 0; continue; }
+        if (hashes && c == '#') { while (i < code.size() && code[i] != '\n') i++; lineStart = true; continue; }
+        if (slashes && c == '/' && i + 1 < code.size() && code[i + 1] == '/') { while (i < code.size() && code[i] != '\n') i++; lineStart = true; continue; }
+        if (slashes && c == '/' && i + 1 < code.size() && code[i + 1] == '*') {
+            size_t end = code.find("*/", i + 2);
+            i = (end == string_view::npos) ? code.size() : end + 1;
+            continue;
+        }
+        if (c == '"' || (c == '\'' && langId != "rust")) quote = c;
+        if (!isspace((unsigned char)c)) out += c;
+    }
+    return out;
+}
+
+// Model output for a chunk, with the original chunk's trailing whitespace restored
+string fitChunk(const string& reply, string_view original) {
+    size_t keep = original.find_last_not_of(" \t\r\n");
+    string_view tail = (keep == string_view::npos) ? original : original.substr(keep + 1);
+    string out = reply;
+    out.erase(0, out.find_first_not_of("\r\n"));
+    size_t last = out.find_last_not_of(" \t\r\n");
+    out.erase(last == string::npos ? 0 : last + 1);
+    out += tail;
+    return out;
+}
+
+struct ChunkResult {
+    string text;
+    bool unchanged = false;
+    string error;
+};
+
+// Runs one prompt per chunk (up to 4 in flight) and stitches the replies. Returns "ERROR: ..."
+// when any chunk fails, so nothing is written.
+string processInChunks(const string& code, const LangProfile& lang, bool allowUnchanged, bool checkSkeleton,
+                       const function<PromptBuffer(size_t, size_t, const string&, const string&)>& makePrompt, ostream& out) {
+    vector<CodeChunk> chunks = splitCodeChunks(code, lang.id);
+    string outline = codeOutline(code, lang.id);
+    out << "[CHUNK] " << chunks.size() << " part(s) of ~" << CHUNK_TARGET_CHARS / 1000 << "K chars" << endl;
+
+    vector<ChunkResult> results(chunks.size());
+    parallelFor(chunks.size(), [&](size_t i) {
+        string part = code.substr(chunks[i].begin, chunks[i].end - chunks[i].begin);
+        string response = callAI(makePrompt(i, chunks.size(), outline, part));
+        string text = extractCode(response, lang);
+        if (text.find("ERROR:") == 0) { results[i].error = text; return; }
+        string trimmed = text;
+        trimmed.erase(0, trimmed.find_first_not_of(" \t\r\n`"));
+        trimmed.erase(trimmed.find_last_not_of(" \t\r\n`") + 1);
+        if (allowUnchanged && trimmed == "UNCHANGED") { results[i].text = part; results[i].unchanged = true; return; }
+        results[i].text = fitChunk(text, part);
+        if (results[i].text == part) results[i].unchanged = true;
+    }, 4);
+
+    string stitched;
+    stitched.reserve(code.size() + code.size() / 4);
+    size_t kept = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        string_view original(code.data() + chunks[i].begin, chunks[i].end - chunks[i].begin);
+        ChunkResult& r = results[i];
+        if (!r.error.empty()) return r.error + " (part " + to_string(i + 1) + "/" + to_string(chunks.size()) + ")";
+        if (!r.unchanged && checkSkeleton) {
+            string before = codeSkeleton(original, lang.id);
+            if (!before.empty() && before != codeSkeleton(r.text, lang.id)) {
+                out << "   [WARN] Part " << (i + 1) << " altered the code itself; keeping the original." << endl;
+                r.text = string(original);
+                r.unchanged = true;
+            }
+        }
+        if (r.unchanged) kept++;
+        stitched += r.text;
+    }
+    out << "[CHUNK] " << (chunks.size() - kept) << " part(s) changed, " << kept << " preserved." << endl;
+    return stitched;
+}
+
+int fixFile(const string& targetFile, const string& instruction, const string& mode, ChunkMode chunking, ostream& out) {
+    if (!fs::exists(targetFile)) {
+        out << "[ERROR] File not found: " << targetFile << endl;
+        return 1;
+    }
+
+    out << "[FIX] Reading " << targetFile << "..." << endl;
+    ifstream f(targetFile);
+    string content((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+    f.close();
+
+    LangProfile fileLang = langForFile(targetFile);
+    string langName = fileLang.name.empty() ? "Code" : fileLang.name;
+
+    out << "[AI] Applying fix (" << mode << ")..." << endl;
+    string fixedCode;
+    if (chunking == ChunkMode::ALWAYS || (chunking == ChunkMode::AUTO && content.size() > CHUNK_THRESHOLD_CHARS)) {
+        fixedCode = processInChunks(content, fileLang, true, false,
+            [&](size_t i, size_t n, const string& outline, const string& part) {
+                PromptBuffer prompt;
+                prompt << "ROLE: Expert " << langName << " developer.\n";
+                prompt << "TASK: Fix the code based on the instruction. You are given one part of " << targetFile << ".\n";
+                prompt << "RULES:\n";
+                prompt << "1. Return this part only, complete, with the fix applied.\n";
+                prompt << "2. Do not add code that belongs to other parts of the file.\n";
+                prompt << "3. If this part needs no change for the instruction, reply with exactly: UNCHANGED\n";
+                prompt << "4. The part may start or end inside an enclosing block; keep its braces and indentation exactly as given.\n";
+                prompt << "INSTRUCTION: " << instruction << "\n";
+                prompt.section(PromptBuffer::HOST) << "FILE OUTLINE (whole file, for reference only):\n" << outline << "\n";
+                prompt.section(PromptBuffer::PASS) << "PART " << (i + 1) << "/" << n << ":\n" << part << "\n";
+                prompt << "OUTPUT: Return ONLY the fixed code (or UNCHANGED). No markdown. No explanations.";
+                return prompt;
+            }, out);
+    } else {
+        stringstream prompt;
+        prompt << "ROLE: Expert " << langName << " developer.\n";
+        prompt << "TASK: Fix the code based on the instruction.\n";
+        prompt << "INSTRUCTION: " << instruction << "\n";
+        prompt << "CODE:\n" << content << "\n";
+        prompt << "OUTPUT: Return ONLY the fixed code. No markdown. No explanations.";
+
+        string response = callAI(prompt.str());
+        fixedCode = extractCode(response, fileLang);
+    }
+
+    if (fixedCode.find("ERROR:") == 0) {
+        out << "   [!] API Error: " << fixedCode.substr(6) << endl;
+        return 1;
+    }
+
+    ofstream file(targetFile);
+    file << fixedCode;
+    file.close();
+    
+    out << "[SUCCESS] File updated: " << targetFile << endl;
+    return 0;
+}
+
+int explainFile(const string& targetFile, const string& language, const string& mode, ChunkMode chunking, ostream& out) {
+    if (!fs::exists(targetFile)) {
+        out << "[ERROR] File not found: " << targetFile << endl;
+        return 1;
+    }
+
+    out << "[EXPLAIN] Reading " << targetFile << "..." << endl;
+    ifstream f(targetFile);
+    string content((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+    f.close();
+
+    auto writeRules = [&](stringstream& prompt) {
+        prompt << "STRICT RULES:\n";
+        prompt << "1. RETURN THE FULL SOURCE CODE exactly as provided but with added comments.\n";
+        prompt << "2. DO NOT simplify the code. DO NOT replace it with examples like 'Hello World'.\n";
+        prompt << "3. Use the language's standard comment syntax.\n";
+        prompt << "4. Document functions, logic blocks, and variables.\n";
+        prompt << "5. Ensure all comments are written in " << language << ".\n";
+        prompt << "6. Return ONLY the code in a markdown block.\n\n";
+    };
+
+    out << "[AI] Generating documentation in " << language << " (" << mode << ")..." << endl;
+    LangProfile fileLang = langForFile(targetFile);
+    string docCode;
+    if (chunking == ChunkMode::ALWAYS || (chunking == ChunkMode::AUTO && content.size() > CHUNK_THRESHOLD_CHARS)) {
+        docCode = processInChunks(content, fileLang, false, true,
+            [&](size_t i, size_t n, const string& outline, const string& part) {
+                stringstream rules;
+                rules << "TASK: Add high-quality technical documentation comments to the provided code in " << language << ".\n";
+                rules << "You are given one part of " << targetFile << ".\n";
+                writeRules(rules);
+                rules << "The part may start or end inside an enclosing block; keep its braces and indentation exactly as given.\n\n";
+                PromptBuffer prompt;
+                prompt << rules.str();
+                prompt.section(PromptBuffer::HOST) << "FILE OUTLINE (whole file, for reference only):\n" << outline << "\n";
+                prompt.section(PromptBuffer::PASS) << "CODE TO DOCUMENT (PART " << (i + 1) << "/" << n << "):\n" << part;
+                return prompt;
+            }, out);
+    } else {
+        stringstream prompt;
+        prompt << "TASK: Add high-quality technical documentation comments to the provided code in " << language << ".\n";
+        writeRules(prompt);
+        prompt << "CODE TO DOCUMENT:\n" << content;
+
+        string response = callAI(prompt.str());
+        docCode = extractCode(response, fileLang);
+    }
+
+    if (docCode.find("ERROR:") == 0) {
+        out << "   [!] API Error: " << docCode.substr(6) << endl;
+        return 1;
+    }
+
+    string ext = getExt(targetFile);
+    string docFile = stripExt(targetFile) + "_doc" + ext;
+    
+    ofstream file(docFile);
+    file << docCode;
+    file.close();
+    
+    out << "[SUCCESS] Documentation generated: " << docFile << endl;
+    return 0;
+}
+
+// --- TREE SHAKING ---
+// [NEW] Trims IMPORTed modules to what the inputs use. Every module is split into top-level
+// units (the chunk splitter's boundaries) and the names each unit defines are extracted.
+// Starting from the identifiers in the host code and containers, units defining a referenced
+// name are kept and their own identifiers join the reference set, until nothing changes.
+// Dropped units leave their signature behind as a comment. Units that define no recognisable
+// name (includes, top-level statements, decorated definitions) are always kept, and a module
+// none of whose definitions is referenced is kept whole: the prompt then refers to it in bulk.
+const string MODULE_START_MARK = "// >>>>>> START MODULE: ";
+const string MODULE_END_MARK = "// <<<<<< END MODULE: ";
+
+void collectIdentifiers(string_view text, set<string>& out) {
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char c = text[i];
+        if (isalpha(c) || c == '_') {
+            size_t j = i + 1;
+            while (j < text.size() && (isalnum((unsigned char)text[j]) || text[j] == '_')) j++;
+            if (j - i > 1) out.emplace(text.substr(i, j - i));
+            i = j;
+        } else if (isdigit(c)) {
+            while (i < text.size() && (isalnum((unsigned char)text[i]) || text[i] == '_')) i++;
+        } else {
+            i++;
+        }
+    }
+}
+
+// Name defined by a top-level line ("" when it defines none we recognise)
+string definedName(string line) {
+    static const set<string> modifiers = {"export", "pub", "pub(crate)", "public", "private", "protected", "internal", "static",
+                                          "async", "default", "abstract", "final", "inline", "extern", "virtual", "unsafe",
+                                          "override", "open", "data", "sealed", "constexpr", "partial", "readonly", "declare"};
+    static const set<string> definers = {"class", "struct", "enum", "interface", "trait", "union", "namespace", "def", "fn",
+                                         "func", "function", "fun", "mod", "module", "object", "protocol", "record", "type", "impl"};
+    static const set<string> bindings = {"let", "const", "var", "val"};
+    static const set<string> notNames = {"if", "for", "while", "switch", "return", "catch", "sizeof", "else", "do", "operator", "mut"};
+
+    line.erase(0, line.find_first_not_of(" \t"));
+    auto nextWord = [](const string& s, size_t& pos) {
+        while (pos < s.size() && isspace((unsigned char)s[pos])) pos++;
+        size_t start = pos;
+        while (pos < s.size() && (isalnum((unsigned char)s[pos]) || s[pos] == '_' || s[pos] == '!')) pos++;
+        string word = s.substr(start, pos - start);
+        // Rust visibility "pub(crate)"
+        if (word == "pub" && pos < s.size() && s[pos] == '(') {
+            size_t close = s.find(')', pos);
+            pos = close == string::npos ? s.size() : close + 1;
+        }
+        return word;
+    };
+    auto lastIdentifier = [&](const string& s) {
+        size_t end = s.size();
+        while (end > 0 && !(isalnum((unsigned char)s[end - 1]) || s[end - 1] == '_')) end--;
+        size_t start = end;
+        while (start > 0 && (isalnum((unsigned char)s[start - 1]) || s[start - 1] == '_')) start--;
+        string id = s.substr(start, end - start);
+        return (id.empty() || isdigit((unsigned char)id[0]) || notNames.count(id)) ? string() : id;
+    };
+
+    if (line.rfind("#define", 0) == 0) {
+        size_t pos = 7;
+        string name = nextWord(line, pos);
+        return name.substr(0, name.find('('));
+    }
+    // Comments, decorators, preprocessor lines and closing brackets define nothing
+    if (line.empty() || string_view("#}{)]@/*\"'").find(line[0]) != string_view::npos) return "";
+
+    size_t pos = 0;
+    string word = nextWord(line, pos);
+    while (modifiers.count(word)) word = nextWord(line, pos);
+
+    if (definers.count(word)) {
+        // Go receivers "func (r *T) Name", generics "impl<T>", "enum class", "impl Trait for Type"
+        string rest = line.substr(pos);
+        rest.erase(0, rest.find_first_not_of(" \t"));
+        if (!rest.empty() && rest[0] == '(') rest.erase(0, rest.find(')') == string::npos ? rest.size() : rest.find(')') + 1);
+        if (!rest.empty() && rest[0] == '<') rest.erase(0, rest.find('>') == string::npos ? rest.size() : rest.find('>') + 1);
+        if (word == "impl" && rest.find(" for ") != string::npos) rest = rest.substr(rest.find(" for ") + 5);
+        size_t p = 0;
+        string name = nextWord(rest, p);
+        if (name == "class" || name == "struct") name = nextWord(rest, p);
+        return notNames.count(name) ? "" : name;
+    }
+    if (bindings.count(word)) {
+        string decl = line.substr(0, line.find('='));
+        decl = decl.substr(0, decl.find(':'));
+        return lastIdentifier(decl);
+    }
+    if (word == "typedef" || word == "using") {
+        string decl = line.substr(0, line.find_first_of(";="));
+        return lastIdentifier(decl);
+    }
+    // [FIX] Anything else needs a declaration shape: "type name(" or "name =". Calls such as
+    // "setup_logging()" or "app.listen(3000);" are statements, which are always kept
+    static const set<string> notTypes = {"return", "new", "delete", "await", "yield", "throw", "raise", "assert", "del",
+                                         "print", "go", "defer", "not", "and", "or", "in", "is", "case", "goto"};
+    auto declaredName = [&](const string& head) {
+        string name = lastIdentifier(head);
+        if (name.empty()) return string();
+        size_t start = head.rfind(name);
+        // "obj.name" / "obj->name" assign or call through an object
+        if (start > 0 && (head[start - 1] == '.' || (start > 1 && head.compare(start - 2, 2, "->") == 0))) return string();
+        return name;
+    };
+    size_t paren = line.find('(');
+    size_t eq = line.find('=');
+    if (paren != string::npos && (eq == string::npos || paren < eq)) {
+        string head = line.substr(0, paren);
+        string name = declaredName(head);
+        if (name.empty() || head.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_ \t*&:<>,[]~") != string::npos ||
+            head.find("<<") != string::npos) return "";
+        // A return type must precede the name, past any "Foo::" qualifier; constructors
+        // "Foo::Foo(" and destructors "Foo::~Foo(" have none
+        string type = head.substr(0, head.rfind(name));
+        while (type.size() >= 2 && type.compare(type.size() - 2, 2, "::") == 0) {
+            type.resize(type.size() - 2);
+            if (!type.empty() && type.back() == '~') type.pop_back();
+            string scope = lastIdentifier(type);
+            if (scope == name) return name;
+            type.resize(type.size() - scope.size());
+        }
+        size_t p = 0;
+        string first = nextWord(type, p);
+        return (first.empty() || notTypes.count(first)) ? "" : name;
+    }
+    if (eq != string::npos && line.compare(eq, 2, "==") != 0 && string_view("+-*/%|&^!<>").find(eq > 0 ? line[eq - 1] : ' ') == string_view::npos)
+        return declaredName(line.substr(0, eq));
+    return "";
+}
+
+struct ShakeUnit {
+    size_t begin, end;     // Offsets into the module's own text
+    set<string> names;     // Names the unit defines
+    string signature;
+    bool kept = false;
+};
+
+struct ShakeModule {
+    string header, footer; // Marker lines
+    string langId;
+    string own;            // Module text with nested modules replaced by placeholder lines
+    vector<ShakeUnit> units;
+    bool whole = false;    // Emit unchanged
+};
+
+struct ShakeStats {
+    size_t modules = 0, units = 0, dropped = 0, bytesBefore = 0, bytesAfter = 0;
+};
+
+// Shakes the modules inside each resolved input in place; identifiers are gathered across
+// all inputs, since one input may use a module another one imports
+ShakeStats treeShakeImports(vector<string>& inputs) {
+    ShakeStats stats;
+    vector<ShakeModule> modules;
+    vector<string> hosts; // Input text outside modules, with placeholders
+    const string placeholder = "\x01YORI_MODULE:";
+
+    // Split every input into host text and modules, innermost first
+    for (const string& text : inputs) {
+        string host;
+        vector<size_t> open; // Indices into `modules` of the modules being read
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t eol = text.find('\n', pos);
+            size_t next = eol == string::npos ? text.size() : eol + 1;
+            string_view line(text.data() + pos, next - pos);
+            if (line.substr(0, MODULE_START_MARK.size()) == MODULE_START_MARK) {
+                string ref = placeholder + to_string(modules.size()) + "\n";
+                (open.empty() ? host : modules[open.back()].own) += ref;
+                ShakeModule m;
+                m.header = string(line);
+                size_t lp = line.rfind('('), rp = line.rfind(')');
+                if (lp != string_view::npos && rp != string_view::npos && rp > lp) m.langId = langForFile("m" + string(line.substr(lp + 1, rp - lp - 1))).id;
+                modules.push_back(move(m));
+                open.push_back(modules.size() - 1);
+            } else if (!open.empty() && line.substr(0, MODULE_END_MARK.size()) == MODULE_END_MARK) {
+                modules[open.back()].footer = string(line);
+                open.pop_back();
+            } else {
+                (open.empty() ? host : modules[open.back()].own) += line;
+            }
+            pos = next;
+        }
+        if (!open.empty()) return stats; // Unbalanced markers: leave everything alone
+        hosts.push_back(move(host));
+    }
+    if (modules.empty()) return stats;
+
+    // Units and the names they define
+    set<string> referenced;
+    for (const string& h : hosts) collectIdentifiers(h, referenced);
+    for (auto& m : modules) {
+        vector<size_t> starts = topLevelBoundaries(m.own, m.langId);
+        starts.insert(starts.begin(), 0);
+        starts.push_back(m.own.size());
+        vector<LineInfo> lines = scanCodeLines(m.own, m.langId);
+        size_t li = 0;
+        for (size_t i = 0; i + 1 < starts.size(); i++) {
+            if (starts[i] == starts[i + 1]) continue;
+            ShakeUnit u{starts[i], starts[i + 1], {}, "", false};
+            bool decorated = false;
+            for (; li < lines.size() && lines[li].pos < u.end; li++) {
+                const LineInfo& l = lines[li];
+                if (l.blank || l.quoted || l.depth != 0) continue;
+                size_t eol = m.own.find('\n', l.pos);
+                string text = m.own.substr(l.pos, (eol == string::npos ? m.own.size() : eol) - l.pos);
+                if (text.rfind(placeholder, 0) == 0) continue;
+                if (text.find_first_not_of(" \t") != string::npos && text[text.find_first_not_of(" \t")] == '@') decorated = true;
+                string name = definedName(text);
+                if (name.empty()) continue;
+                u.names.insert(name);
+                if (u.signature.empty()) {
+                    u.signature = unitSignature(m.own, l.pos, m.langId);
+                    string head = u.signature.substr(0, u.signature.find('{'));
+                    while (!head.empty() && head.back() == ' ') head.pop_back();
+                    if (!head.empty()) u.signature = head;
+                }
+            }
+            // [FIX] Decorators usually register what they wrap ("@app.route"), so decorated
+            // units are kept like top-level statements
+            if (decorated) u.names.clear();
+            m.units.push_back(move(u));
+        }
+    }
+
+    // Fixpoint over kept units; modules nobody references by name are kept whole
+    auto keep = [&](ShakeModule& m, ShakeUnit& u) {
+        u.kept = true;
+        collectIdentifiers(string_view(m.own).substr(u.begin, u.end - u.begin), referenced);
+    };
+    for (auto& m : modules) for (auto& u : m.units) if (u.names.empty()) keep(m, u);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& m : modules) {
+            for (auto& u : m.units) {
+                if (u.kept) continue;
+                for (const auto& n : u.names) if (referenced.count(n)) { keep(m, u); changed = true; break; }
+            }
+        }
+        if (changed) continue;
+        for (auto& m : modules) {
+            if (m.whole) continue;
+            bool anyNamed = false, anyUsed = false;
+            for (const auto& u : m.units) {
+                if (u.names.empty()) continue;
+                anyNamed = true;
+                if (u.kept) anyUsed = true;
+            }
+            if (anyNamed && !anyUsed) {
+                m.whole = true;
+                for (auto& u : m.units) if (!u.kept) keep(m, u);
+                changed = true;
+            }
+        }
+    }
+
+    // Render modules bottom-up (nested modules are always later in the list)
+    vector<string> rendered(modules.size());
+    auto expand = [&](string_view text, string& out) {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t eol = text.find('\n', pos);
+            size_t next = eol == string_view::npos ? text.size() : eol + 1;
+            string_view line = text.substr(pos, next - pos);
+            if (line.substr(0, placeholder.size()) == placeholder) out += rendered[strtoul(string(line.substr(placeholder.size())).c_str(), nullptr, 10)];
+            else out += line;
+            pos = next;
+        }
+    };
+    for (size_t i = modules.size(); i-- > 0;) {
+        ShakeModule& m = modules[i];
+        size_t keptBytes = 0, droppedUnits = 0;
+        for (const auto& u : m.units) {
+            if (u.kept) keptBytes += u.end - u.begin;
+            else droppedUnits++;
+        }
+        // Not worth losing context for small savings
+        if (keptBytes * 10 >= m.own.size() * 8) m.whole = true;
+        stats.modules++;
+        stats.units += m.units.size();
+        stats.bytesBefore += m.own.size();
+
+        string body;
+        if (m.whole) {
+            body = m.own;
+        } else {
+            stats.dropped += droppedUnits;
+            body = "// [TREE-SHAKEN] " + to_string(m.units.size() - droppedUnits) + " of " + to_string(m.units.size()) +
+                   " definitions kept; the others are listed by signature only\n";
+            for (const auto& u : m.units) {
+                string_view text = string_view(m.own).substr(u.begin, u.end - u.begin);
+                if (u.kept) { body += text; continue; }
+                body += "// [SHAKEN] " + u.signature + "\n";
+                // Nested modules imported from inside a dropped unit stay
+                for (size_t p = text.find(placeholder); p != string_view::npos; p = text.find(placeholder, p + 1)) {
+                    size_t eol = text.find('\n', p);
+                    body += text.substr(p, (eol == string_view::npos ? text.size() : eol + 1) - p);
+                }
+                if (!body.empty() && body.back() != '\n') body += "\n";
+            }
+        }
+        stats.bytesAfter += body.size();
+        string out = m.header;
+        expand(body, out);
+        if (!m.footer.empty() && !out.empty() && out.back() != '\n') out += "\n";
+        out += m.footer;
+        rendered[i] = move(out);
+    }
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        string out;
+        out.reserve(hosts[i].size());
+        expand(hosts[i], out);
+        inputs[i] = move(out);
+    }
+    return stats;
+}
+
+// --- CHUNK INDEX ---
+// [NEW] Retrieval for growing projects. Generated files are split into chunks (functions,
+// classes, small files whole) and kept in an on-disk index, refreshed per file when its size
+// or mtime changes. Prompts that used to carry every earlier file instead get the chunks that
+// best match the task (BM25 over identifier terms, via an in-memory inverted index) until the
+// token budget is filled. Projects that fit the budget are still sent whole.
+const size_t INDEX_CHUNK_CHARS = 1500;
+const string CHUNK_INDEX_FILE = CACHE_DIR + "/chunk_index.json";
+
+// Lower-case search terms: identifiers plus their camelCase / snake_case parts
+void indexTerms(string_view text, map<string, int>& tf) {
+    auto lower = [](string_view s) {
+        string out(s);
+        transform(out.begin(), out.end(), out.begin(), ::tolower);
+        return out;
+    };
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char c = text[i];
+        if (!isalpha(c) && c != '_') { i++; continue; }
+        size_t j = i + 1;
+        while (j < text.size() && (isalnum((unsigned char)text[j]) || text[j] == '_')) j++;
+        string_view id = text.substr(i, j - i);
+        if (id.size() >= 2) tf[lower(id)]++;
+
+        vector<string_view> parts;
+        size_t start = 0;
+        for (size_t k = 1; k <= id.size(); k++) {
+            bool cut = k == id.size() || id[k] == '_' ||
+                       (isupper((unsigned char)id[k]) && (islower((unsigned char)id[k - 1]) ||
+                        (k + 1 < id.size() && islower((unsigned char)id[k + 1]) && isupper((unsigned char)id[k - 1]))));
+            if (!cut) continue;
+            string_view part = id.substr(start, k - start);
+            while (!part.empty() && part[0] == '_') part.remove_prefix(1);
+            if (!part.empty()) parts.push_back(part);
+            start = k;
+        }
+        if (parts.size() > 1) {
+            for (auto p : parts) if (p.size() >= 2) tf[lower(p)]++;
+        }
+        i = j;
+    }
+}
+
+struct IndexedChunk {
+    size_t begin = 0, end = 0;
+    string signature;
+    map<string, int> terms;
+    size_t length = 0; // Total term count
+};
+
+struct IndexedFile {
+    long long mtime = 0;
+    uintmax_t size = 0;
+    vector<IndexedChunk> chunks;
+};
+
+class ChunkIndex {
+public:
+    struct Hit {
+        string file;
+        const IndexedChunk* chunk;
+        double score;
+    };
+
+    void load() {
+        ifstream f(CHUNK_INDEX_FILE);
+        if (!f.is_open()) return;
+        json j = json::parse(f, nullptr, false);
+        if (j.is_discarded() || j.value("version", 0) != 1 || !j.contains("files")) return;
+        for (auto& [name, jf] : j["files"].items()) {
+            IndexedFile file;
+            file.mtime = jf.value("mtime", 0LL);
+            file.size = jf.value("size", (uintmax_t)0);
+            for (const auto& jc : jf["chunks"]) {
+                IndexedChunk c;
+                c.begin = jc.value("begin", (size_t)0);
+                c.end = jc.value("end", (size_t)0);
+                c.signature = jc.value("signature", "");
+                for (auto& [t, n] : jc["terms"].items()) { c.terms[t] = n.get<int>(); c.length += n.get<int>(); }
+                file.chunks.push_back(move(c));
+            }
+            files[name] = move(file);
+        }
+        postingsStale = true;
+    }
+
+    void save() {
+        if (!dirty) return;
+        json j;
+        j["version"] = 1;
+        json& jfiles = j["files"];
+        jfiles = json::object();
+        for (const auto& [name, file] : files) {
+            json chunks = json::array();
+            for (const auto& c : file.chunks) chunks.push_back({{"begin", c.begin}, {"end", c.end}, {"signature", c.signature}, {"terms", c.terms}});
+            jfiles[name] = {{"mtime", file.mtime}, {"size", file.size}, {"chunks", chunks}};
+        }
+        error_code ec;
+        fs::create_directories(CACHE_DIR, ec);
+        string tmp = makeTempName(CHUNK_INDEX_FILE, ".tmp");
+        { ofstream f(tmp); f << j.dump(); }
+        fs::rename(tmp, CHUNK_INDEX_FILE, ec);
+        if (ec) fs::remove(tmp, ec);
+        dirty = false;
+    }
+
+    // Re-indexes `file` if it changed since it was indexed; false when it cannot be read
+    bool update(const string& file) {
+        error_code ec;
+        uintmax_t size = fs::file_size(file, ec);
+        if (ec) { if (files.erase(file)) { dirty = postingsStale = true; } return false; }
+        long long mtime = (long long)fs::last_write_time(file, ec).time_since_epoch().count();
+        auto it = files.find(file);
+        if (it != files.end() && it->second.size == size && it->second.mtime == mtime) return true;
+
+        ifstream in(file, ios::binary);
+        string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        string langId = langForFile(file).id;
+        IndexedFile entry;
+        entry.mtime = mtime;
+        entry.size = size;
+        for (const auto& c : splitCodeChunks(text, langId, INDEX_CHUNK_CHARS)) {
+            IndexedChunk chunk;
+            chunk.begin = c.begin;
+            chunk.end = c.end;
+            chunk.signature = unitSignature(text, c.begin, langId);
+            indexTerms(string_view(text).substr(c.begin, c.end - c.begin), chunk.terms);
+            for (const auto& [t, n] : chunk.terms) chunk.length += n;
+            entry.chunks.push_back(move(chunk));
+        }
+        files[file] = move(entry);
+        dirty = postingsStale = true;
+        return true;
+    }
+
+    // BM25 (k1 = 1.2, b = 0.75) over the chunks of `candidates`, best first
+    vector<Hit> search(const string& query, const vector<string>& candidates) {
+        if (postingsStale) rebuildPostings();
+        set<string> allowed(candidates.begin(), candidates.end());
+        size_t n = 0;
+        double totalLength = 0;
+        for (const auto& f : allowed) {
+            auto it = files.find(f);
+            if (it == files.end()) continue;
+            for (const auto& c : it->second.chunks) { n++; totalLength += c.length; }
+        }
+        if (n == 0) return {};
+        double avgLength = max(1.0, totalLength / n);
+
+        map<string, int> queryTerms;
+        indexTerms(query, queryTerms);
+        map<const IndexedChunk*, Hit> scores;
+        for (const auto& [term, qtf] : queryTerms) {
+            auto p = postings.find(term);
+            if (p == postings.end()) continue;
+            size_t df = 0;
+            for (const auto& post : p->second) if (allowed.count(*post.file)) df++;
+            if (df == 0) continue;
+            double idf = std::log(1.0 + (n - df + 0.5) / (df + 0.5));
+            for (const auto& post : p->second) {
+                if (!allowed.count(*post.file)) continue;
+                double tf = post.tf;
+                double s = idf * tf * 2.2 / (tf + 1.2 * (0.25 + 0.75 * post.chunk->length / avgLength));
+                Hit& h = scores.emplace(post.chunk, Hit{*post.file, post.chunk, 0.0}).first->second;
+                h.score += s;
+            }
+        }
+        vector<Hit> hits;
+        for (auto& [c, h] : scores) hits.push_back(h);
+        sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) { return a.score > b.score; });
+        return hits;
+    }
+
+private:
+    struct Posting {
+        const string* file;
+        const IndexedChunk* chunk;
+        int tf;
+    };
+
+    void rebuildPostings() {
+        postings.clear();
+        for (const auto& [name, file] : files) {
+            for (const auto& c : file.chunks) {
+                for (const auto& [t, tf] : c.terms) postings[t].push_back({&name, &c, tf});
+            }
+        }
+        postingsStale = false;
+    }
+
+    map<string, IndexedFile> files;
+    unordered_map<string, vector<Posting>> postings;
+    bool dirty = false;
+    bool postingsStale = true;
+};
+
+// Project context for a prompt: every file in full while they fit the retrieval budget,
+// otherwise the file list plus the best-matching chunks for `query`, in file order
+string retrieveContext(ChunkIndex& index, const vector<string>& files, const string& query) {
+    auto readFile = [](const string& f) {
+        ifstream in(f, ios::binary);
+        return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    };
+    size_t budget = RETRIEVAL_BUDGET_TOKENS * 4; // ~4 chars per token
+    size_t total = 0;
+    for (const auto& f : files) {
+        error_code ec;
+        total += fs::file_size(f, ec);
+    }
+    string context;
+    if (!RETRIEVAL_ENABLED || total <= budget) {
+        for (const auto& f : files) context += "// --- FILE: " + f + " ---\n" + readFile(f) + "\n";
+        return context;
+    }
+
+    for (const auto& f : files) index.update(f);
+    vector<ChunkIndex::Hit> hits = index.search(query, files);
+    index.save();
+
+    map<string, vector<const IndexedChunk*>> picked;
+    size_t used = 0, count = 0;
+    for (const auto& h : hits) {
+        if (count >= RETRIEVAL_TOP_K) break;
+        size_t size = h.chunk->end - h.chunk->begin;
+        if (used + size > budget) continue;
+        picked[h.file].push_back(h.chunk);
+        used += size;
+        count++;
+    }
+
+    context += "PROJECT FILES: ";
+    for (size_t i = 0; i < files.size(); i++) context += (i ? ", " : "") + files[i];
+    context += "\n(Only the excerpts most relevant to this task are shown.)\n";
+    for (const auto& f : files) {
+        auto it = picked.find(f);
+        if (it == picked.end()) continue;
+        sort(it->second.begin(), it->second.end(), [](const IndexedChunk* a, const IndexedChunk* b) { return a->begin < b->begin; });
+        string text = readFile(f);
+        context += "// --- FILE: " + f + " (excerpts) ---\n";
+        for (const IndexedChunk* c : it->second) {
+            if (c->end > text.size()) continue;
+            size_t line = 1 + count_if(text.begin(), text.begin() + c->begin, [](char ch) { return ch == '\n'; });
+            context += "// ... line " + to_string(line) + "\n" + text.substr(c->begin, c->end - c->begin);
+            if (context.back() != '\n') context += "\n";
+        }
+    }
+    cout << "   [CONTEXT] " << count << " chunk(s) from " << picked.size() << " of " << files.size() << " file(s), ~"
+         << used / 4 << " of " << total / 4 << " tokens" << endl;
+    return context;
+}
+
+// --- BATCH MODE ---
+// [NEW] fix/explain over a directory tree: config, backend pool, rate limiter and model
+// warm-up are shared by all files in one process. Files run on a worker pool; each file's
+// log is buffered and printed as one block when it finishes.
+struct BatchOptions {
+    unsigned jobs = 1;
+    vector<string> include;
+    vector<string> exclude;
+    bool force = false; // explain: regenerate even when the _doc output is up to date
+};
+
+// Glob match: `*` and `?` stay within one path segment, `**` crosses segments
+bool globMatch(const char* pat, const char* s) {
+    if (*pat == '\0') return *s == '\0';
+    if (pat[0] == '*' && pat[1] == '*') {
+        const char* rest = pat + 2;
+        if (*rest == '/') rest++;
+        for (const char* p = s; ; p++) {
+            if (globMatch(rest, p)) return true;
+            if (*p == '\0') return false;
+        }
+    }
+    if (*pat == '*') {
+        for (const char* p = s; ; p++) {
+            if (globMatch(pat + 1, p)) return true;
+            if (*p == '\0' || *p == '/') return false;
+        }
+    }
+    if (*s == '\0') return false;
+    if (*pat == '?') return *s != '/' && globMatch(pat + 1, s + 1);
+    return *pat == *s && globMatch(pat + 1, s + 1);
+}
+
+// Patterns without a slash match the file name, others the path relative to the root
+bool matchesAnyGlob(const vector<string>& patterns, const string& relPath) {
+    string name = fs::path(relPath).filename().string();
+    for (const auto& p : patterns) {
+        const string& subject = p.find('/') == string::npos ? name : relPath;
+        if (globMatch(p.c_str(), subject.c_str())) return true;
+    }
+    return false;
+}
+
+// Source files under root with a known language extension (or matching --include), sorted.
+// Hidden directories, yori_cache, build outputs and generated _doc files are skipped.
+vector<string> collectBatchFiles(const fs::path& root, const BatchOptions& opt) {
+    static const set<string> skipDirs = {"yori_cache", "build", "node_modules", "target", "bin", "obj", "__pycache__"};
+    vector<string> files;
+    error_code ec;
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        string name = it->path().filename().string();
+        if (it->is_directory(ec)) {
+            if ((name.size() > 1 && name[0] == '.') || skipDirs.count(name)) it.disable_recursion_pending();
+            continue;
+        }
+        if (!it->is_regular_file(ec) || name[0] == '.') continue;
+        string rel = fs::relative(it->path(), root, ec).generic_string();
+        string stem = it->path().stem().string();
+        if (stem.size() > 4 && stem.compare(stem.size() - 4, 4, "_doc") == 0) continue;
+        if (opt.include.empty() ? langForFile(name).id.empty() : !matchesAnyGlob(opt.include, rel)) continue;
+        if (matchesAnyGlob(opt.exclude, rel)) continue;
+        files.push_back(it->path().string());
+    }
+    sort(files.begin(), files.end());
+    return files;
+}
+
+// True when the _doc output exists and is newer than its source
+bool docUpToDate(const string& file) {
+    error_code ec;
+    fs::path docFile = stripExt(file) + "_doc" + getExt(file);
+    if (!fs::exists(docFile, ec)) return false;
+    auto docTime = fs::last_write_time(docFile, ec);
+    if (ec) return false;
+    auto srcTime = fs::last_write_time(file, ec);
+    return !ec && docTime >= srcTime;
+}
+
+// Runs `perFile` on every file under root; returns 1 when any file failed
+int runBatch(const string& label, const fs::path& root, const BatchOptions& opt, bool skipFresh,
+             const function<int(const string&, ostream&)>& perFile) {
+    vector<string> files = collectBatchFiles(root, opt);
+    if (files.empty()) {
+        cout << "[BATCH] No source files found under " << root.string() << endl;
+        return 1;
+    }
+
+    vector<string> todo;
+    size_t skipped = 0;
+    for (const auto& f : files) {
+        if (skipFresh && !opt.force && docUpToDate(f)) skipped++;
+        else todo.push_back(f);
+    }
+    cout << "[BATCH] " << label << ": " << todo.size() << " file(s), " << skipped << " up to date, " << opt.jobs << " worker(s)" << endl;
+    // [FIX] Workers share the provider's request slots: more workers than slots only queue
+    CallOptions first = tierOptions(selectTier(0, 0));
+    string group = first.profile.empty() ? PROVIDER : first.profile;
+    set<const RateLimiter*> limiters;
+    int slots = 0;
+    for (const auto& b : BACKENDS) {
+        if (b.group == group && b.limiter && limiters.insert(b.limiter.get()).second) slots += b.limiter->concurrency();
+    }
+    if (slots > 0 && opt.jobs > (unsigned)slots) {
+        cout << "[WARN] -j " << opt.jobs << " is capped at " << slots << " concurrent model request(s) by rate_limit.max_concurrent"
+             << " in config.json (local default: 1)." << endl;
+    }
+    if (!todo.empty()) startModelWarmUp(selectTier(0, 0));
+
+    mutex printMutex;
+    atomic<size_t> done{0}, failed{0};
+    atomic<uintmax_t> bytes{0};
+    auto start = chrono::steady_clock::now();
+    parallelFor(todo.size(), [&](size_t i) {
+        stringstream out;
+        error_code ec;
+        uintmax_t size = fs::file_size(todo[i], ec);
+        LogScope scope("batch:" + todo[i]);
+        int rc = perFile(todo[i], out);
+        if (rc != 0) failed++;
+        else bytes += ec ? 0 : size;
+        size_t n = ++done;
+        lock_guard<mutex> lock(printMutex);
+        cout << "--- [" << n << "/" << todo.size() << "] " << todo[i] << (rc != 0 ? " (FAILED)" : "") << " ---\n" << out.str() << flush;
+    }, opt.jobs);
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t ok = todo.size() - failed;
+    cout << "[BATCH] Done in " << formatDuration((long long)secs) << ": " << ok << " ok, " << failed << " failed, " << skipped << " skipped";
+    if (secs > 0 && ok > 0) {
+        cout << fixed << setprecision(2) << " (" << ok / secs << " files/s, " << (bytes / 1024.0) / secs << " KB/s)";
+        cout.unsetf(ios::floatfield);
+    }
+    cout << endl;
+    log("INFO", "Batch " + label + ": " + to_string(ok) + " ok, " + to_string(failed) + " failed, " + to_string(skipped) + " skipped in " + to_string(secs) + "s");
+    return failed ? 1 : 0;
+}
+
+// Consumes a batch flag at argv[i] (advancing i past its value); false when argv[i] is not one
+bool parseBatchFlag(int argc, char* argv[], int& i, BatchOptions& opt) {
+    string arg = argv[i];
+    if (arg == "-force") { opt.force = true; return true; }
+    if ((arg == "-j" || arg == "-include" || arg == "-exclude") && i + 1 < argc) {
+        string val = argv[++i];
+        if (arg == "-j") opt.jobs = (unsigned)max(1, atoi(val.c_str()));
+        else (arg == "-include" ? opt.include : opt.exclude).push_back(val);
+        return true;
+    }
+    if (arg.rfind("-j", 0) == 0 && arg.size() > 2 && isdigit((unsigned char)arg[2])) {
+        opt.jobs = (unsigned)max(1, atoi(arg.c_str() + 2));
+        return true;
+    }
+    return false;
+}
+
+// --- LOCAL DIFF ---
+// [NEW] `yori diff` diffs locally first (Myers on lines, plus a matcher over top-level units).
+// The model only sees the changed hunks with their enclosing signatures; files without line
+// changes are reported locally with no model call.
+struct DiffEdit {
+    char op;     // ' ' kept, '-' removed from A, '+' added in B
+    size_t a, b; // Current line in A and B (the next line for the side not involved)
+};
+
+// Lines without their '\n' (and a trailing '\r', so CRLF/LF files compare equal)
+vector<string_view> splitLines(const string& text) {
+    vector<string_view> lines;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t eol = text.find('\n', pos);
+        if (eol == string::npos) eol = text.size();
+        size_t len = eol - pos;
+        if (len > 0 && text[pos + len - 1] == '\r') len--;
+        lines.emplace_back(text.data() + pos, len);
+        pos = eol + 1;
+    }
+    return lines;
+}
+
+// Myers O((N+M)D) line diff. Common prefix/suffix are stripped and lines interned first.
+// Returns false when more than maxD lines differ (the files were mostly rewritten).
+bool myersDiff(const vector<string_view>& A, const vector<string_view>& B, vector<DiffEdit>& edits, int maxD = 2000) {
+    size_t prefix = 0, suffix = 0;
+    while (prefix < A.size() && prefix < B.size() && A[prefix] == B[prefix]) prefix++;
+    while (suffix < A.size() - prefix && suffix < B.size() - prefix && A[A.size() - 1 - suffix] == B[B.size() - 1 - suffix]) suffix++;
+
+    unordered_map<string_view, int> ids;
+    auto intern = [&](const vector<string_view>& src, size_t from, size_t to) {
+        vector<int> out;
+        out.reserve(to - from);
+        for (size_t i = from; i < to; i++) out.push_back(ids.emplace(src[i], (int)ids.size()).first->second);
+        return out;
+    };
+    vector<int> a = intern(A, prefix, A.size() - suffix), b = intern(B, prefix, B.size() - suffix);
+    int n = (int)a.size(), m = (int)b.size();
+    int dMax = min(n + m, maxD);
+
+    // Forward pass; trace[d] holds V for k in [-d, d] after step d
+    int off = dMax + 1;
+    vector<int> V(2 * dMax + 3, 0);
+    vector<vector<int>> trace;
+    int D = -1;
+    for (int d = 0; d <= dMax && D < 0; d++) {
+        for (int k = -d; k <= d; k += 2) {
+            int x = (k == -d || (k != d && V[off + k - 1] < V[off + k + 1])) ? V[off + k + 1] : V[off + k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y]) { x++; y++; }
+            V[off + k] = x;
+            if (x >= n && y >= m) { D = d; break; }
+        }
+        trace.emplace_back(V.begin() + off - d, V.begin() + off + d + 1);
+    }
+    if (D < 0) return false;
+
+    // Backtrack from (n, m)
+    vector<DiffEdit> rev;
+    int x = n, y = m;
+    for (int d = D; d > 0; d--) {
+        const vector<int>& prev = trace[d - 1];
+        auto Vp = [&](int k) { return prev[k + d - 1]; };
+        int k = x - y;
+        int prevK = (k == -d || (k != d && Vp(k - 1) < Vp(k + 1))) ? k + 1 : k - 1;
+        int prevX = Vp(prevK), prevY = prevX - prevK;
+        while (x > prevX && y > prevY) { x--; y--; rev.push_back({' ', prefix + x, prefix + y}); }
+        if (prevK == k + 1) { y--; rev.push_back({'+', prefix + x, prefix + y}); }
+        else { x--; rev.push_back({'-', prefix + x, prefix + y}); }
+    }
+    while (x > 0 && y > 0) { x--; y--; rev.push_back({' ', prefix + x, prefix + y}); }
+
+    edits.clear();
+    edits.reserve(prefix + rev.size() + suffix);
+    for (size_t i = 0; i < prefix; i++) edits.push_back({' ', i, i});
+    edits.insert(edits.end(), rev.rbegin(), rev.rend());
+    for (size_t i = 0; i < suffix; i++) edits.push_back({' ', A.size() - suffix + i, B.size() - suffix + i});
+    return true;
+}
+
+struct DiffHunk {
+    size_t aStart, aLen, bStart, bLen;
+    size_t firstChange; // Index into the edit list
+    string body;        // Unified-diff lines
+};
+
+// Groups changes into hunks with `context` unchanged lines around them
+vector<DiffHunk> buildHunks(const vector<string_view>& A, const vector<string_view>& B, const vector<DiffEdit>& edits, size_t context = 3) {
+    vector<DiffHunk> hunks;
+    size_t i = 0;
+    while (i < edits.size()) {
+        if (edits[i].op == ' ') { i++; continue; }
+        size_t first = i, last = i;
+        for (size_t j = i + 1; j < edits.size(); j++) {
+            if (edits[j].op == ' ') { if (j - last > 2 * context) break; continue; }
+            last = j;
+        }
+        size_t from = first > context ? first - context : 0;
+        size_t to = min(edits.size(), last + context + 1);
+        DiffHunk h{edits[from].a, 0, edits[from].b, 0, first, ""};
+        for (size_t j = from; j < to; j++) {
+            const DiffEdit& e = edits[j];
+            if (e.op != '+') h.aLen++;
+            if (e.op != '-') h.bLen++;
+            h.body += e.op;
+            h.body += e.op == '+' ? B[e.b] : A[e.a];
+            h.body += '\n';
+        }
+        hunks.push_back(move(h));
+        i = last + 1;
+    }
+    return hunks;
+}
+
+// Enclosing scopes of a line, outermost first ("class Foo > void bar()"), at most three levels
+string enclosingScope(const string& code, const vector<LineInfo>& lines, size_t lineIdx) {
+    if (lineIdx >= lines.size()) return "";
+    vector<string> chain;
+    int target = lines[lineIdx].depth;
+    for (size_t j = lineIdx; j-- > 0 && target > 0 && chain.size() < 3;) {
+        const LineInfo& l = lines[j];
+        if (l.blank || l.quoted || l.depth >= target) continue;
+        size_t eol = code.find('\n', l.pos);
+        string sig = code.substr(l.pos, (eol == string::npos ? code.size() : eol) - l.pos);
+        sig.erase(0, sig.find_first_not_of(" \t"));
+        sig = sig.substr(0, sig.find('{'));
+        while (!sig.empty() && (sig.back() == ' ' || sig.back() == '\r')) sig.pop_back();
+        if (sig.empty() || string_view("#@*/})]").find(sig[0]) != string_view::npos) continue;
+        chain.push_back(sig.substr(0, 160));
+        target = l.depth;
+    }
+    string out;
+    for (size_t i = chain.size(); i-- > 0;) out += chain[i] + (i ? " > " : "");
+    return out;
+}
+
+// Top-level units matched by signature: added, removed and modified (same signature, new body)
+struct UnitChanges {
+    vector<string> added, removed, modified;
+};
+
+UnitChanges matchUnits(const string& codeA, const string& codeB, const string& langId) {
+    auto units = [&](const string& code) {
+        map<string, size_t> out;
+        vector<size_t> starts = topLevelBoundaries(code, langId);
+        starts.insert(starts.begin(), 0);
+        starts.push_back(code.size());
+        for (size_t i = 0; i + 1 < starts.size(); i++) {
+            string sig = unitSignature(code, starts[i], langId);
+            if (sig.empty()) continue;
+            string_view body(code.data() + starts[i], starts[i + 1] - starts[i]);
+            out[sig] = out[sig] * 31 + hash<string_view>{}(body); // Repeated signatures (overloads) fold into one entry
+        }
+        return out;
+    };
+    map<string, size_t> a = units(codeA), b = units(codeB);
+    UnitChanges c;
+    for (const auto& [sig, h] : a) {
+        auto it = b.find(sig);
+        if (it == b.end()) c.removed.push_back(sig);
+        else if (it->second != h) c.modified.push_back(sig);
+    }
+    for (const auto& [sig, h] : b) if (!a.count(sig)) c.added.push_back(sig);
+    return c;
+}
+
+// --- SERVER MODE ---
+// [NEW] `yori serve`: one daemon per user taking jobs over a local HTTP API (127.0.0.1 only,
+// bearer token from the state file). Jobs run this binary as a child process in the job's
+// working directory, because the build pipeline works on process-wide state (cwd, language,
+// model). The daemon queues jobs for a fixed worker pool, streams their output, cancels whole
+// process groups and keeps the local model loaded between jobs. The CLI forwards commands to
+// it while it runs (set YORI_NO_DAEMON=1 to run in-process).
+const int SERVE_DEFAULT_PORT = 7878;
+const size_t SERVE_OUTPUT_CAP = 8 * 1024 * 1024; // Per job; older output is dropped beyond this
+const size_t SERVE_KEEP_JOBS = 200;              // Finished jobs kept for polling
+
+fs::path serveStateFile() {
+    return yoriHomeDir() / "serve.json";
+}
+
+struct ServeJob {
+    string id;
+    vector<string> args;
+    string cwd;
+    vector<string> env;      // Caller's environment ("NAME=value"); empty = the daemon's. Never reported back.
+    string state = "queued"; // queued, running, done, failed, cancelled
+    int exitCode = -1;
+    string output;
+    size_t outputBase = 0;   // Bytes already dropped from the front of `output`
+    long long pid = 0;
+    bool cancelRequested = false;
+    time_t created = 0, started = 0, finished = 0;
+
+    bool over() const { return state == "done" || state == "failed" || state == "cancelled"; }
+};
+
+json jobToJson(const ServeJob& j) {
+    return json{{"id", j.id}, {"args", j.args}, {"cwd", j.cwd}, {"state", j.state}, {"exit_code", j.exitCode},
+                {"created", (long long)j.created}, {"started", (long long)j.started}, {"finished", (long long)j.finished},
+                {"output_bytes", j.outputBase + j.output.size()}};
+}
+
+#ifndef _WIN32
+extern char** environ;
+volatile sig_atomic_t SERVE_SIGNAL = 0;
+
+struct HttpMessage {
+    string start;                // Request line or status line
+    map<string, string> headers; // Lower-case names
+    string body;
+};
+
+// [FIX] Sockets are close-on-exec: a job forked while a connection is open must not keep that
+// connection (or the listening port) alive after the daemon is done with it
+int cloexecSocket() {
+    #ifdef SOCK_CLOEXEC
+    return socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    #else
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0) fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+    #endif
+}
+
+int cloexecAccept(int lfd) {
+    #ifdef __linux__
+    return accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+    #else
+    int fd = accept(lfd, nullptr, nullptr);
+    if (fd >= 0) fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+    #endif
+}
+
+bool sendAll(int fd, string_view data) {
+    while (!data.empty()) {
+        ssize_t n = send(fd, data.data(), data.size(), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data.remove_prefix(n);
+    }
+    return true;
+}
+
+// Reads one HTTP message head; with `wholeBody` also its Content-Length body, otherwise
+// `body` holds whatever arrived after the head
+bool readHttpMessage(int fd, HttpMessage& msg, bool wholeBody = true, size_t maxBody = 1 << 20) {
+    string buf;
+    char chunk[4096];
+    size_t headEnd;
+    while ((headEnd = buf.find("\r\n\r\n")) == string::npos) {
+        if (buf.size() > 65536) return false;
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf.append(chunk, n);
+    }
+    stringstream head(buf.substr(0, headEnd));
+    getline(head, msg.start);
+    if (!msg.start.empty() && msg.start.back() == '\r') msg.start.pop_back();
+    string line;
+    while (getline(head, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        size_t colon = line.find(':');
+        if (colon == string::npos) continue;
+        string name = line.substr(0, colon);
+        transform(name.begin(), name.end(), name.begin(), ::tolower);
+        size_t value = line.find_first_not_of(' ', colon + 1);
+        msg.headers[name] = value == string::npos ? "" : line.substr(value);
+    }
+    msg.body = buf.substr(headEnd + 4);
+    if (!wholeBody) return true;
+    size_t length = msg.headers.count("content-length") ? strtoull(msg.headers["content-length"].c_str(), nullptr, 10) : 0;
+    if (length > maxBody) return false;
+    while (msg.body.size() < length) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        msg.body.append(chunk, n);
+    }
+    msg.body.resize(length);
+    return true;
+}
+
+bool sendHttp(int fd, int status, const string& body, const string& type = "application/json") {
+    static const map<int, string> reasons = {{200, "OK"}, {202, "Accepted"}, {400, "Bad Request"}, {401, "Unauthorized"},
+                                             {404, "Not Found"}, {405, "Method Not Allowed"}, {409, "Conflict"}};
+    auto it = reasons.find(status);
+    string head = "HTTP/1.1 " + to_string(status) + " " + (it != reasons.end() ? it->second : "Error") +
+                  "\r\nContent-Type: " + type + "\r\nContent-Length: " + to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    return sendAll(fd, head + body);
+}
+
+class JobServer {
+public:
+    string exePath;
+    string token;
+    unsigned workers = 2;
+
+    int run(int port) {
+        signal(SIGPIPE, SIG_IGN);
+        int lfd = cloexecSocket();
+        int one = 1;
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((uint16_t)port);
+        if (lfd < 0 || bind(lfd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 64) != 0) {
+            cout << "[ERROR] Cannot listen on 127.0.0.1:" << port << " (" << strerror(errno) << ")" << endl;
+            if (lfd >= 0) close(lfd);
+            return 1;
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(lfd, (sockaddr*)&addr, &len);
+        port = ntohs(addr.sin_port);
+
+        // State file: readable by this user only, since the token lets callers run jobs
+        fs::path stateFile = serveStateFile();
+        error_code ec;
+        fs::create_directories(stateFile.parent_path(), ec);
+        {
+            ofstream f(stateFile);
+            f << json{{"pid", (long long)getpid()}, {"port", port}, {"token", token}, {"version", CURRENT_VERSION}}.dump(2);
+        }
+        fs::permissions(stateFile, fs::perms::owner_read | fs::perms::owner_write, fs::perm_options::replace, ec);
+
+        signal(SIGINT, [](int) { SERVE_SIGNAL = 1; });
+        signal(SIGTERM, [](int) { SERVE_SIGNAL = 1; });
+
+        cout << "[SERVE] Listening on http://127.0.0.1:" << port << " with " << workers << " worker(s) (pid " << getpid() << ")" << endl;
+        cout << "[SERVE] State file: " << stateFile.string() << endl;
+        log("INFO", "Server started on port " + to_string(port));
+
+        vector<thread> pool;
+        for (unsigned i = 0; i < workers; i++) pool.emplace_back([this]() { workerLoop(); });
+        thread warmer([this]() { keepWarmLoop(); });
+
+        while (!stopping && !SERVE_SIGNAL) {
+            pollfd p{lfd, POLLIN, 0};
+            if (poll(&p, 1, 500) <= 0) continue;
+            int fd = cloexecAccept(lfd);
+            if (fd < 0) continue;
+            timeval timeout{10, 0}; // A stalled client must not pin a thread forever
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            thread([this, fd]() { handleConnection(fd); close(fd); }).detach();
+        }
+        close(lfd);
+
+        cout << "[SERVE] Shutting down..." << endl;
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+            for (auto& [id, job] : jobs) {
+                if (job->state == "queued") { job->state = "cancelled"; job->finished = time(nullptr); }
+                else if (job->state == "running") job->cancelRequested = true;
+            }
+            queue.clear();
+        }
+        queueCv.notify_all();
+        outputCv.notify_all();
+        for (auto& t : pool) t.join();
+        warmer.join();
+
+        // Leave the file alone if another daemon has replaced it meanwhile
+        ifstream f(stateFile);
+        json state = json::parse(f, nullptr, false);
+        f.close();
+        if (!state.is_discarded() && state.value("pid", 0LL) == (long long)getpid()) fs::remove(stateFile, ec);
+        log("INFO", "Server stopped");
+        return 0;
+    }
+
+private:
+    mutex mtx;
+    condition_variable queueCv, outputCv;
+    deque<shared_ptr<ServeJob>> queue;
+    map<string, shared_ptr<ServeJob>> jobs;
+    deque<string> order; // Job ids, oldest first
+    size_t nextId = 1;
+    atomic<bool> stopping{false};
+    atomic<time_t> lastActivity{0};
+
+    void workerLoop() {
+        while (true) {
+            shared_ptr<ServeJob> job;
+            {
+                unique_lock<mutex> lock(mtx);
+                queueCv.wait(lock, [&]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                job = queue.front();
+                queue.pop_front();
+            }
+            runJob(job);
+        }
+    }
+
+    // Reloads the local model every 4 minutes while jobs came in during the last 30
+    void keepWarmLoop() {
+        time_t lastWarm = 0;
+        unique_lock<mutex> lock(mtx);
+        while (!stopping) {
+            time_t now = time(nullptr);
+            if (now - lastActivity < 1800 && now - lastWarm >= 240) {
+                lock.unlock();
+                startModelWarmUp(selectTier(0, 0));
+                lock.lock();
+                lastWarm = now;
+            }
+            queueCv.wait_for(lock, chrono::seconds(5));
+        }
+    }
+
+    void finishJob(const shared_ptr<ServeJob>& job, const string& state, int code) {
+        lock_guard<mutex> lock(mtx);
+        job->state = state;
+        job->exitCode = code;
+        job->finished = time(nullptr);
+        job->pid = 0;
+        outputCv.notify_all();
+        log(state == "done" ? "INFO" : "WARN", "Job " + job->id + " " + state + " (exit " + to_string(code) + ")");
+    }
+
+    void runJob(const shared_ptr<ServeJob>& job) {
+        // Everything the child needs is built before fork(): only async-signal-safe calls after it
+        vector<string> argStore = {exePath};
+        argStore.insert(argStore.end(), job->args.begin(), job->args.end());
+        vector<char*> argv;
+        for (auto& a : argStore) argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(nullptr);
+        // The job runs with the caller's environment (PATH, toolchain variables, API keys)
+        vector<string> envStore;
+        if (job->env.empty()) for (char** e = environ; *e; e++) envStore.push_back(*e);
+        else envStore = job->env;
+        envStore.erase(remove_if(envStore.begin(), envStore.end(), [](const string& e) { return e.rfind("YORI_NO_DAEMON=", 0) == 0; }), envStore.end());
+        envStore.push_back("YORI_NO_DAEMON=1");
+        vector<char*> envp;
+        for (auto& e : envStore) envp.push_back(const_cast<char*>(e.c_str()));
+        envp.push_back(nullptr);
+        string cwd = job->cwd;
+
+        int fds[2];
+        if (cloexecPipe(fds) != 0) { finishJob(job, "failed", -1); return; }
+        pid_t pid = fork();
+        if (pid < 0) { close(fds[0]); close(fds[1]); finishJob(job, "failed", -1); return; }
+        if (pid == 0) {
+            setpgid(0, 0);
+            if (chdir(cwd.c_str()) != 0) _exit(126);
+            int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (devnull >= 0) dup2(devnull, 0);
+            dup2(fds[1], 1); dup2(fds[1], 2);
+            close(fds[0]); close(fds[1]);
+            execve(argv[0], argv.data(), envp.data());
+            _exit(127);
+        }
+        setpgid(pid, pid);
+        close(fds[1]);
+        {
+            lock_guard<mutex> lock(mtx);
+            job->pid = pid;
+            job->state = "running";
+            job->started = time(nullptr);
+        }
+        log("INFO", "Job " + job->id + " started (pid " + to_string(pid) + ")");
+
+        // Read until the child exits; background processes it left behind may hold the pipe
+        // open, so the exit (not EOF) ends the job
+        bool exited = false, termSent = false;
+        int status = 0;
+        auto termAt = chrono::steady_clock::now();
+        char chunk[8192];
+        while (true) {
+            bool cancel;
+            { lock_guard<mutex> lock(mtx); cancel = job->cancelRequested; }
+            if (cancel && !termSent) { kill(-pid, SIGTERM); termSent = true; termAt = chrono::steady_clock::now(); }
+            else if (termSent && !exited && chrono::steady_clock::now() - termAt > chrono::seconds(3)) kill(-pid, SIGKILL);
+            if (!exited && waitpid(pid, &status, WNOHANG) == pid) exited = true;
+
+            pollfd p{fds[0], POLLIN, 0};
+            if (poll(&p, 1, exited ? 0 : 200) <= 0) { if (exited) break; continue; }
+            ssize_t n = read(fds[0], chunk, sizeof(chunk));
+            if (n <= 0) { if (!exited) waitpid(pid, &status, 0); break; }
+            lock_guard<mutex> lock(mtx);
+            job->output.append(chunk, n);
+            if (job->output.size() > SERVE_OUTPUT_CAP) {
+                size_t drop = job->output.size() - SERVE_OUTPUT_CAP / 2;
+                job->output.erase(0, drop);
+                job->outputBase += drop;
+            }
+            outputCv.notify_all();
+        }
+        close(fds[0]);
+
+        bool cancelled;
+        { lock_guard<mutex> lock(mtx); cancelled = job->cancelRequested; }
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        finishJob(job, cancelled ? "cancelled" : (code == 0 ? "done" : "failed"), code);
+    }
+
+    // Caller holds mtx
+    void pruneJobs() {
+        size_t finished = 0;
+        for (const auto& id : order) if (jobs[id]->over()) finished++;
+        for (auto it = order.begin(); it != order.end() && finished > SERVE_KEEP_JOBS;) {
+            if (jobs[*it]->over()) { jobs.erase(*it); it = order.erase(it); finished--; }
+            else ++it;
+        }
+    }
+
+    string submit(const json& req) {
+        if (!req.is_object() || !req.contains("args") || !req["args"].is_array() || req["args"].empty())
+            return "ERROR: \"args\" must be a non-empty array of strings";
+        vector<string> args;
+        for (const auto& a : req["args"]) {
+            if (!a.is_string()) return "ERROR: \"args\" must be a non-empty array of strings";
+            args.push_back(a.get<string>());
+        }
+        if (args[0] == "serve") return "ERROR: serve cannot run as a job";
+        string cwd = req.value("cwd", "");
+        error_code ec;
+        if (cwd.empty() || !fs::path(cwd).is_absolute() || !fs::is_directory(cwd, ec)) return "ERROR: \"cwd\" must be an existing absolute directory";
+
+        auto job = make_shared<ServeJob>();
+        job->args = args;
+        job->cwd = cwd;
+        if (req.contains("env")) {
+            if (!req["env"].is_object()) return "ERROR: \"env\" must be an object of strings";
+            for (auto& [name, value] : req["env"].items()) {
+                if (!value.is_string() || name.empty() || name.find('=') != string::npos) return "ERROR: \"env\" must be an object of strings";
+                job->env.push_back(name + "=" + value.get<string>());
+            }
+        }
+        job->created = time(nullptr);
+        {
+            lock_guard<mutex> lock(mtx);
+            if (stopping) return "ERROR: server is shutting down";
+            job->id = "job-" + to_string(nextId++);
+            jobs[job->id] = job;
+            order.push_back(job->id);
+            queue.push_back(job);
+            pruneJobs();
+        }
+        lastActivity = time(nullptr);
+        queueCv.notify_all();
+        log("INFO", "Job " + job->id + " queued: " + args[0] + " in " + cwd);
+        return job->id;
+    }
+
+    void cancel(const shared_ptr<ServeJob>& job) {
+        lock_guard<mutex> lock(mtx);
+        if (job->state == "queued") {
+            queue.erase(remove(queue.begin(), queue.end(), job), queue.end());
+            job->state = "cancelled";
+            job->finished = time(nullptr);
+            outputCv.notify_all();
+        } else if (job->state == "running") {
+            job->cancelRequested = true;
+        }
+    }
+
+    // Sends output from `offset` on, then keeps the connection open and forwards new output
+    // until the job ends or the client goes away
+    void streamOutput(int fd, const shared_ptr<ServeJob>& job, size_t offset) {
+        if (!sendAll(fd, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; charset=utf-8\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n")) return;
+        while (true) {
+            string piece;
+            bool over;
+            {
+                unique_lock<mutex> lock(mtx);
+                outputCv.wait_for(lock, chrono::milliseconds(500), [&]() {
+                    return job->over() || job->outputBase + job->output.size() > offset;
+                });
+                offset = max(offset, job->outputBase);
+                piece = job->output.substr(offset - job->outputBase);
+                offset += piece.size();
+                over = job->over();
+            }
+            if (!piece.empty() && !sendAll(fd, piece)) return;
+            if (over) return;
+            // Detect clients that disconnected while the job is silent
+            char probe;
+            if (piece.empty() && recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT) == 0) return;
+        }
+    }
+
+    void handleConnection(int fd) {
+        HttpMessage req;
+        if (!readHttpMessage(fd, req)) { sendHttp(fd, 400, json{{"error", "malformed request"}}.dump()); return; }
+        if (req.headers["authorization"] != "Bearer " + token) { sendHttp(fd, 401, json{{"error", "missing or wrong token"}}.dump()); return; }
+
+        stringstream line(req.start);
+        string method, target;
+        line >> method >> target;
+        string path = target.substr(0, target.find('?'));
+        map<string, string> query;
+        if (target.find('?') != string::npos) {
+            stringstream qs(target.substr(target.find('?') + 1));
+            string kv;
+            while (getline(qs, kv, '&')) {
+                size_t eq = kv.find('=');
+                query[kv.substr(0, eq)] = eq == string::npos ? "1" : kv.substr(eq + 1);
+            }
+        }
+
+        if (path == "/health" && method == "GET") {
+            lock_guard<mutex> lock(mtx);
+            size_t running = 0;
+            for (const auto& [id, job] : jobs) if (job->state == "running") running++;
+            sendHttp(fd, 200, json{{"version", CURRENT_VERSION}, {"pid", (long long)getpid()}, {"workers", workers},
+                                   {"queued", queue.size()}, {"running", running}}.dump());
+            return;
+        }
+        if (path == "/shutdown" && method == "POST") {
+            sendHttp(fd, 200, json{{"stopping", true}}.dump());
+            stopping = true;
+            return;
+        }
+        if (path == "/jobs") {
+            if (method == "GET") {
+                json list = json::array();
+                lock_guard<mutex> lock(mtx);
+                for (const auto& id : order) list.push_back(jobToJson(*jobs[id]));
+                sendHttp(fd, 200, list.dump());
+            } else if (method == "POST") {
+                string id = submit(json::parse(req.body, nullptr, false));
+                if (id.find("ERROR:") == 0) { sendHttp(fd, 400, json{{"error", id.substr(7)}}.dump()); return; }
+                lock_guard<mutex> lock(mtx);
+                sendHttp(fd, 202, jobToJson(*jobs[id]).dump());
+            } else {
+                sendHttp(fd, 405, json{{"error", "use GET or POST"}}.dump());
+            }
+            return;
+        }
+        if (path.rfind("/jobs/", 0) == 0) {
+            string rest = path.substr(6);
+            string id = rest.substr(0, rest.find('/'));
+            string action = rest.find('/') == string::npos ? "" : rest.substr(rest.find('/') + 1);
+            shared_ptr<ServeJob> job;
+            {
+                lock_guard<mutex> lock(mtx);
+                if (jobs.count(id)) job = jobs[id];
+            }
+            if (!job) { sendHttp(fd, 404, json{{"error", "no such job"}}.dump()); return; }
+
+            if (action.empty() && method == "GET") {
+                lock_guard<mutex> lock(mtx);
+                sendHttp(fd, 200, jobToJson(*job).dump());
+            } else if ((action.empty() && method == "DELETE") || (action == "cancel" && method == "POST")) {
+                cancel(job);
+                lock_guard<mutex> lock(mtx);
+                sendHttp(fd, 200, jobToJson(*job).dump());
+            } else if (action == "output" && method == "GET") {
+                size_t offset = query.count("offset") ? strtoull(query["offset"].c_str(), nullptr, 10) : 0;
+                if (query.count("follow")) { streamOutput(fd, job, offset); return; }
+                string piece;
+                {
+                    lock_guard<mutex> lock(mtx);
+                    offset = min(max(offset, job->outputBase), job->outputBase + job->output.size());
+                    piece = job->output.substr(offset - job->outputBase);
+                }
+                sendHttp(fd, 200, piece, "text/plain; charset=utf-8");
+            } else {
+                sendHttp(fd, 405, json{{"error", "unsupported method or action"}}.dump());
+            }
+            return;
+        }
+        sendHttp(fd, 404, json{{"error", "unknown endpoint"}}.dump());
+    }
+};
+
+// Connects to the running daemon described by the state file; -1 when there is none
+int connectDaemon(json& state) {
+    ifstream f(serveStateFile());
+    if (!f.is_open()) return -1;
+    state = json::parse(f, nullptr, false);
+    if (state.is_discarded() || !state.contains("port") || !state.contains("token")) return -1;
+    int fd = cloexecSocket();
+    if (fd < 0) return -1;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)state["port"].get<int>());
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) { close(fd); return -1; }
+    return fd;
+}
+
+// One request to the daemon. Returns the HTTP status, or 0 when no daemon answered.
+// With `stream` set, the response body is passed to it as it arrives instead of being stored.
+int daemonRequest(const string& method, const string& path, const string& body, HttpMessage& reply,
+                  const function<bool(string_view)>& stream = nullptr) {
+    json state;
+    int fd = connectDaemon(state);
+    if (fd < 0) return 0;
+    string req = method + " " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nAuthorization: Bearer " + state["token"].get<string>() +
+                 "\r\nContent-Type: application/json\r\nContent-Length: " + to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    int status = 0;
+    if (sendAll(fd, req) && readHttpMessage(fd, reply, !stream)) {
+        stringstream line(reply.start);
+        string version;
+        line >> version >> status;
+        if (stream) {
+            bool keepGoing = reply.body.empty() || stream(reply.body);
+            char chunk[8192];
+            while (keepGoing) {
+                pollfd p{fd, POLLIN, 0};
+                int r = poll(&p, 1, 200);
+                if (r < 0 && errno != EINTR) break;
+                if (r <= 0) { keepGoing = stream(string_view()); continue; } // Idle tick
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) break;
+                keepGoing = stream(string_view(chunk, n));
+            }
+        }
+    }
+    close(fd);
+    return status;
+}
+
+volatile sig_atomic_t FORWARD_INTERRUPT = 0;
+#endif
+
+// Runs a CLI invocation on the daemon when one is running; false means "run it here".
+// Output is streamed back and Ctrl+C cancels the remote job.
+bool forwardToDaemon(int argc, char* argv[], int& exitCode) {
+    #ifdef _WIN32
+    return false;
+    #else
+    static const set<string> local = {"serve", "config", "clean", "--version", "-v"};
+    if (getenv("YORI_NO_DAEMON") || local.count(argv[1])) return false;
+    // Jobs get no stdin: builds can ask questions (target menu, [y/N]), so on a terminal they run here
+    static const set<string> neverPrompt = {"fix", "explain", "diff", "sos"};
+    if (isatty(0) && !neverPrompt.count(argv[1])) return false;
+    json state;
+    int probe = connectDaemon(state);
+    if (probe < 0) return false;
+    close(probe);
+    if (state.value("version", "") != CURRENT_VERSION) return false; // Different build: don't mix
+
+    vector<string> args(argv + 1, argv + argc);
+    json env = json::object();
+    for (char** e = environ; *e; e++) {
+        const char* eq = strchr(*e, '=');
+        if (eq && eq != *e) env[string(*e, eq - *e)] = string(eq + 1);
+    }
+    error_code ec;
+    HttpMessage reply;
+    json request{{"args", args}, {"cwd", fs::current_path(ec).string()}, {"env", env}};
+    if (daemonRequest("POST", "/jobs", request.dump(-1, ' ', false, json::error_handler_t::replace), reply) != 202) return false;
+    json job = json::parse(reply.body, nullptr, false);
+    if (job.is_discarded() || !job.contains("id")) return false;
+    string id = job["id"];
+    log("INFO", "Forwarded to daemon as " + id);
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, [](int) { FORWARD_INTERRUPT = 1; });
+    bool cancelSent = false;
+    HttpMessage stream;
+    int status = daemonRequest("GET", "/jobs/" + id + "/output?follow=1", "", stream, [&](string_view data) {
+        if (!data.empty()) { cout.write(data.data(), data.size()); cout.flush(); }
+        if (FORWARD_INTERRUPT && !cancelSent) {
+            HttpMessage r;
+            daemonRequest("POST", "/jobs/" + id + "/cancel", "", r);
+            cancelSent = true;
+        }
+        return true;
+    });
+    signal(SIGINT, SIG_DFL);
+
+    HttpMessage done;
+    if (status != 200 || daemonRequest("GET", "/jobs/" + id, "", done) != 200) {
+        cout << "\n[ERROR] Lost connection to the Yori daemon (job " << id << ")." << endl;
+        exitCode = 1;
+        return true;
     }
-    cout << "   [OK] Dependencies verified." << endl;
+    json result = json::parse(done.body, nullptr, false);
+    string jobState = result.is_discarded() ? "failed" : result.value("state", "failed");
+    exitCode = jobState == "cancelled" ? 130 : (result.is_discarded() ? 1 : result.value("exit_code", 1));
     return true;
+    #endif
 }
 
-void selectTarget() {
-    string label = "Language";
-    if (CURRENT_MODE == GenMode::MODEL_3D) label = "3D Format";
-    if (CURRENT_MODE == GenMode::IMAGE) label = "Image Format";
+// `yori serve [--port N] [-j N]`, `yori serve status`, `yori serve stop`
+int runServeCommand(int argc, char* argv[]) {
+    #ifdef _WIN32
+    cout << "[ERROR] yori serve is not available on Windows yet." << endl;
+    return 1;
+    #else
+    string sub = argc > 2 ? argv[2] : "";
+    if (sub == "status" || sub == "stop") {
+        HttpMessage reply;
+        int status = daemonRequest(sub == "stop" ? "POST" : "GET", sub == "stop" ? "/shutdown" : "/health", "", reply);
+        if (status == 0) { cout << "[SERVE] No daemon running." << endl; return 1; }
+        if (sub == "stop") { cout << "[SERVE] Daemon is shutting down." << endl; return 0; }
+        json health = json::parse(reply.body, nullptr, false);
+        if (health.is_discarded()) { cout << "[ERROR] Unexpected reply: " << reply.body << endl; return 1; }
+        cout << "[SERVE] pid " << health.value("pid", 0LL) << ", v" << health.value("version", "?") << ", "
+             << health.value("workers", 0) << " worker(s), " << health.value("running", 0) << " running, "
+             << health.value("queued", 0) << " queued" << endl;
+        return 0;
+    }
 
-    cout << "\n[?] Ambiguous target. Select " << label << ":\n";
-    int i = 1; vector<string> keys;
-    
-    const auto* db = &LANG_DB;
-    if (CURRENT_MODE == GenMode::MODEL_3D) db = &MODEL_DB;
-    else if (CURRENT_MODE == GenMode::IMAGE) db = &IMAGE_DB;
+    int port = SERVE_DEFAULT_PORT;
+    unsigned workers = 2;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) port = atoi(argv[++i]);
+        else if (arg == "-j" && i + 1 < argc) workers = (unsigned)max(1, atoi(argv[++i]));
+        else { cout << "Usage: yori serve [--port N] [-j N] | yori serve status | yori serve stop" << endl; return 1; }
+    }
+    json state;
+    int existing = connectDaemon(state);
+    if (existing >= 0) {
+        close(existing);
+        cout << "[SERVE] A daemon is already running (pid " << state.value("pid", 0LL) << ", port " << state.value("port", 0) << ")." << endl;
+        return 1;
+    }
 
-    for(auto const& [key, val] : *db) keys.push_back(key);
-    for(const auto& k : keys) { cout << i++ << ". " << db->at(k).name << " "; if(i%4==0) cout<<endl;}
-    cout << "\n> "; int c; cin >> c; 
-    if(c>=1 && c<=keys.size()) CURRENT_LANG = db->at(keys[c-1]);
-    else CURRENT_LANG = (CURRENT_MODE == GenMode::CODE) ? LANG_DB["cpp"] : (CURRENT_MODE == GenMode::MODEL_3D ? MODEL_DB["obj"] : IMAGE_DB["svg"]);
+    static JobServer server; // Outlives detached connection threads
+    error_code ec;
+    if (fs::exists("/proc/self/exe", ec)) server.exePath = fs::read_symlink("/proc/self/exe", ec).string();
+    if (server.exePath.empty()) {
+        string self = argv[0];
+        server.exePath = self.find('/') != string::npos ? fs::absolute(self, ec).string() : resolveExecutable(self);
+    }
+    random_device rd;
+    stringstream token;
+    for (int i = 0; i < 4; i++) token << hex << setw(8) << setfill('0') << rd();
+    server.token = token.str();
+    server.workers = workers;
+
+    loadConfig("local"); // Warm-ups use the local profile of the directory the daemon runs in
+    return server.run(port);
+    #endif
 }
 
 // --- MAIN ---
 int main(int argc, char* argv[]) {
     auto startTime = std::chrono::high_resolution_clock::now();
     initLogger(); 
+    #ifndef _WIN32
+    // A dead compile worker or a closed client socket must not take Yori down with it
+    signal(SIGPIPE, SIG_IGN);
+    #endif
 
     if (argc < 2) {
         cout << "YORI v" << CURRENT_VERSION << " (Multi-File)\nUsage: yori file1 ... [-o output] [-cloud/-local] [-3d/-img] [-u] \"*Custom Instructions\"" << endl;
         cout << "Commands:\n  config <key> <val> : Update config.json\n  config model-local : Detect installed Ollama models\n";
         cout << "  clean cache        : Clear semantic cache\n";
-        cout << "  fix <file> \"desc\"  : AI-powered code repair\n";
-        cout << "  explain <file> [lg] : Generate commented documentation\n";
+        cout << "  fix <file|dir> \"desc\" : AI-powered code repair (dir: batch, -j N)\n";
+        cout << "  explain <file|dir> [lg] : Generate commented documentation (dir: batch, -j N)\n";
         cout << "  diff <f1> <f2> [lg] : Generate semantic diff report\n";
         cout << "  sos [lang] \"error\" : Ask AI for help on error/problem (no file needed)\n";
+        cout << "  serve [--port N] [-j N] : Run the job daemon (serve status / serve stop)\n";
         return 0;
     }
 
     // --- COMMAND MODE HANDLING ---
     string cmd = argv[1];
+
+    // [NEW] Hand the whole invocation to `yori serve` when a daemon is running
+    int forwardedExit = 0;
+    if (forwardToDaemon(argc, argv, forwardedExit)) return forwardedExit;
+
+    // [NEW] Scheduling priority for machine-wide model/compile slots; "--priority" is accepted
+    // by every command and removed before the command parses its arguments
+    vector<char*> argStore(argv, argv + argc);
+    int priorityOverride = -1;
+    for (size_t i = 1; i < argStore.size();) {
+        if (string(argStore[i]) != "--priority") { i++; continue; }
+        if (i + 1 >= argStore.size() || (priorityOverride = parsePriority(argStore[i + 1])) < 0) {
+            cerr << "[ERROR] --priority expects batch, normal or interactive." << endl;
+            return 1;
+        }
+        argStore.erase(argStore.begin() + i, argStore.begin() + i + 2);
+    }
+    argc = (int)argStore.size();
+    argv = argStore.data();
+    if (argc < 2) return 1;
+    cmd = argv[1];
+    SCHED_PRIORITY = priorityOverride >= 0 ? priorityOverride : defaultPriority(argc, argv);
+
+    // SERVE COMMAND
+    if (cmd == "serve") return runServeCommand(argc, argv);
     
     // CONFIG COMMAND
     if (cmd == "config") {
@@ -1206,59 +5593,31 @@ int main(int argc, char* argv[]) {
     // FIX COMMAND
     if (cmd == "fix") {
         if (argc < 4) {
-            cout << "Usage: yori fix <file> \"instruction\" [-cloud/-local]" << endl;
+            cout << "Usage: yori fix <file|dir> \"instruction\" [-cloud/-local] [-chunk/-no-chunk] [-j N] [-include glob] [-exclude glob]" << endl;
             return 1;
         }
         string targetFile = argv[2];
         string instruction = argv[3];
         string mode = "local"; 
+        ChunkMode chunking = ChunkMode::AUTO;
+        BatchOptions batch;
 
         for(int i=4; i<argc; i++) {
             string arg = argv[i];
+            if (parseBatchFlag(argc, argv, i, batch)) continue;
             if (arg == "-cloud") mode = "cloud";
             else if (arg == "-local") mode = "local";
+            else if (arg == "-chunk") chunking = ChunkMode::ALWAYS;
+            else if (arg == "-no-chunk") chunking = ChunkMode::NEVER;
         }
 
         if (!loadConfig(mode)) return 1;
-
-        if (!fs::exists(targetFile)) {
-            cout << "[ERROR] File not found: " << targetFile << endl;
-            return 1;
-        }
-
-        cout << "[FIX] Reading " << targetFile << "..." << endl;
-        ifstream f(targetFile);
-        string content((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
-        f.close();
-
-        string ext = getExt(targetFile);
-        string langName = "Code";
-        for(auto const& [key, val] : LANG_DB) {
-            if(val.extension == ext) { langName = val.name; break; }
-        }
-
-        cout << "[AI] Applying fix (" << mode << ")..." << endl;
-        stringstream prompt;
-        prompt << "ROLE: Expert " << langName << " developer.\n";
-        prompt << "TASK: Fix the code based on the instruction.\n";
-        prompt << "INSTRUCTION: " << instruction << "\n";
-        prompt << "CODE:\n" << content << "\n";
-        prompt << "OUTPUT: Return ONLY the fixed code. No markdown. No explanations.";
-
-        string response = callAI(prompt.str());
-        string fixedCode = extractCode(response);
-
-        if (fixedCode.find("ERROR:") == 0) {
-            cout << "   [!] API Error: " << fixedCode.substr(6) << endl;
-            return 1;
+        if (fs::is_directory(targetFile)) {
+            return runBatch("fix", targetFile, batch, false, [&](const string& file, ostream& out) {
+                return fixFile(file, instruction, mode, chunking, out);
+            });
         }
-
-        ofstream out(targetFile);
-        out << fixedCode;
-        out.close();
-        
-        cout << "[SUCCESS] File updated: " << targetFile << endl;
-        return 0;
+        return fixFile(targetFile, instruction, mode, chunking, cout);
     }
 
     // SOS COMMAND (NEW)
@@ -1299,21 +5658,8 @@ int main(int argc, char* argv[]) {
 
         string response = callAI(prompt.str());
         
-        // Manual JSON parsing to get full text (not just code blocks)
-        string answer = response;
-        try {
-            json j = json::parse(response);
-            if (j.contains("choices") && !j["choices"].empty()) {
-                 if (j["choices"][0].contains("message")) answer = j["choices"][0]["message"]["content"];
-                 else if (j["choices"][0].contains("text")) answer = j["choices"][0]["text"];
-            }
-            else if (j.contains("candidates") && !j["candidates"].empty()) {
-                 answer = j["candidates"][0]["content"]["parts"][0]["text"];
-            }
-            else if (j.contains("response")) answer = j["response"];
-        } catch(...) {
-            // If parsing fails, use raw response (might be raw text from some endpoints)
-        }
+        // Full text (not just code blocks); raw response if the endpoint returned plain text
+        string answer = extractResponseText(response);
 
         cout << "\n--- YORI SOS REPLY ---\n";
         cout << answer << endl;
@@ -1324,78 +5670,51 @@ int main(int argc, char* argv[]) {
     // EXPLAIN COMMAND (Modified with Language Support)
     if (cmd == "explain") {
         if (argc < 3) {
-            cout << "Usage: yori explain <file> [-cloud/-local] [language]" << endl;
+            cout << "Usage: yori explain <file|dir> [-cloud/-local] [-chunk/-no-chunk] [-j N] [-include glob] [-exclude glob] [-force] [language]" << endl;
             return 1;
         }
         string targetFile = argv[2];
         string mode = "local"; 
         string language = "English"; // Default
+        ChunkMode chunking = ChunkMode::AUTO;
+        BatchOptions batch;
 
         for(int i=3; i<argc; i++) {
             string arg = argv[i];
+            if (parseBatchFlag(argc, argv, i, batch)) continue;
             if (arg == "-cloud") mode = "cloud";
             else if (arg == "-local") mode = "local";
+            else if (arg == "-chunk") chunking = ChunkMode::ALWAYS;
+            else if (arg == "-no-chunk") chunking = ChunkMode::NEVER;
             else language = arg;
         }
 
         if (!loadConfig(mode)) return 1;
-
-        if (!fs::exists(targetFile)) {
-            cout << "[ERROR] File not found: " << targetFile << endl;
-            return 1;
-        }
-
-        cout << "[EXPLAIN] Reading " << targetFile << "..." << endl;
-        ifstream f(targetFile);
-        string content((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
-        f.close();
-
-        cout << "[AI] Generating documentation in " << language << " (" << mode << ")..." << endl;
-        stringstream prompt;
-        prompt << "TASK: Add high-quality technical documentation comments to the provided code in " << language << ".\n";
-        prompt << "STRICT RULES:\n";
-        prompt << "1. RETURN THE FULL SOURCE CODE exactly as provided but with added comments.\n";
-        prompt << "2. DO NOT simplify the code. DO NOT replace it with examples like 'Hello World'.\n";
-        prompt << "3. Use the language's standard comment syntax.\n";
-        prompt << "4. Document functions, logic blocks, and variables.\n";
-        prompt << "5. Ensure all comments are written in " << language << ".\n";
-        prompt << "6. Return ONLY the code in a markdown block.\n\n";
-        prompt << "CODE TO DOCUMENT:\n" << content;
-
-        string response = callAI(prompt.str());
-        string docCode = extractCode(response);
-
-        if (docCode.find("ERROR:") == 0) {
-            cout << "   [!] API Error: " << docCode.substr(6) << endl;
-            return 1;
+        if (fs::is_directory(targetFile)) {
+            return runBatch("explain", targetFile, batch, true, [&](const string& file, ostream& out) {
+                return explainFile(file, language, mode, chunking, out);
+            });
         }
-
-        string ext = getExt(targetFile);
-        string docFile = stripExt(targetFile) + "_doc" + ext;
-        
-        ofstream out(docFile);
-        out << docCode;
-        out.close();
-        
-        cout << "[SUCCESS] Documentation generated: " << docFile << endl;
-        return 0;
+        return explainFile(targetFile, language, mode, chunking, cout);
     }
 
     // DIFF COMMAND
     if (cmd == "diff") {
         if (argc < 4) {
-            cout << "Usage: yori diff <fileA> <fileB> [-cloud/-local] [language]" << endl;
+            cout << "Usage: yori diff <fileA> <fileB> [-cloud/-local] [-full] [language]" << endl;
             return 1;
         }
         string fileA = argv[2];
         string fileB = argv[3];
         string mode = "local";
         string language = "English";
+        bool fullFiles = false; // Send both files whole instead of the local diff
 
         for(int i=4; i<argc; i++) {
             string arg = argv[i];
             if (arg == "-cloud") mode = "cloud";
             else if (arg == "-local") mode = "local";
+            else if (arg == "-full") fullFiles = true;
             else language = arg;
         }
 
@@ -1412,30 +5731,77 @@ int main(int argc, char* argv[]) {
         string contentA((istreambuf_iterator<char>(fa)), istreambuf_iterator<char>());
         string contentB((istreambuf_iterator<char>(fb)), istreambuf_iterator<char>());
         fa.close(); fb.close();
+        string outName = fs::path(fileA).stem().string() + "_" + fs::path(fileB).stem().string() + "_diff_report.md";
+
+        // [NEW] Local pre-diff: only hunks and unit-level changes go to the model
+        vector<string_view> linesA = splitLines(contentA), linesB = splitLines(contentB);
+        vector<DiffEdit> edits;
+        bool localDiff = !fullFiles && myersDiff(linesA, linesB, edits);
+        size_t added = 0, removed = 0;
+        for (const auto& e : edits) { if (e.op == '+') added++; else if (e.op == '-') removed++; }
+
+        if (localDiff && added + removed == 0) {
+            string note = contentA == contentB ? "The files are identical." : "The files differ only in line endings.";
+            cout << "[DIFF] " << note << " No model call needed." << endl;
+            ofstream out(outName);
+            out << "# Diff report: " << fileA << " vs " << fileB << "\n\n" << note << "\n";
+            out.close();
+            cout << "[SUCCESS] Report generated: " << outName << endl;
+            return 0;
+        }
+
+        stringstream changes;
+        if (localDiff) {
+            LangProfile lang = langForFile(fileB);
+            vector<DiffHunk> hunks = buildHunks(linesA, linesB, edits);
+            vector<LineInfo> infoA = scanCodeLines(contentA, lang.id), infoB = scanCodeLines(contentB, lang.id);
+            UnitChanges units = matchUnits(contentA, contentB, lang.id);
+
+            changes << "STATS: A has " << linesA.size() << " lines, B has " << linesB.size() << " lines; +" << added << " -" << removed
+                    << " lines in " << hunks.size() << " hunk(s).\n";
+            auto listUnits = [&](const char* title, const vector<string>& sigs) {
+                if (sigs.empty()) return;
+                changes << title << ":\n";
+                for (const auto& sig : sigs) changes << "  " << sig << "\n";
+            };
+            listUnits("TOP-LEVEL UNITS ADDED", units.added);
+            listUnits("TOP-LEVEL UNITS REMOVED", units.removed);
+            listUnits("TOP-LEVEL UNITS MODIFIED", units.modified);
+            changes << "\n--- CHANGED HUNKS (unified diff, A -> B) ---\n";
+            for (const auto& h : hunks) {
+                const DiffEdit& e = edits[h.firstChange];
+                string scope = e.op == '-' ? enclosingScope(contentA, infoA, e.a) : enclosingScope(contentB, infoB, e.b);
+                changes << "@@ -" << (h.aStart + 1) << "," << h.aLen << " +" << (h.bStart + 1) << "," << h.bLen << " @@";
+                if (!scope.empty()) changes << " in: " << scope;
+                changes << "\n" << h.body;
+            }
+            // A diff bigger than the files themselves saves nothing
+            if (changes.tellp() > (streamoff)(contentA.size() + contentB.size())) localDiff = false;
+            else cout << "[DIFF] Local diff: +" << added << " -" << removed << " lines in " << hunks.size() << " hunk(s), "
+                      << (units.added.size() + units.removed.size() + units.modified.size()) << " top-level unit(s) touched." << endl;
+        }
 
         stringstream prompt;
         prompt << "ROLE: Expert Software Auditor.\n";
         prompt << "TASK: Compare two source files and generate a semantic diff report in " << language << ".\n";
+        if (localDiff) prompt << "INPUT: A local line diff of " << fileA << " (A) and " << fileB << " (B): only the changed hunks, each with its enclosing scope. Unchanged code is omitted.\n";
         prompt << "REPORT FORMAT:\n";
         prompt << "1. Brief Summary of changes.\n";
         prompt << "2. Changed Functions (What changed and where).\n";
         prompt << "3. Additional Observations (Potential bugs, improvements).\n";
         prompt << "RETURN: Only the report in Markdown format.\n\n";
-        prompt << "--- FILE A (" << fileA << ") ---\n" << contentA << "\n";
-        prompt << "\n--- FILE B (" << fileB << ") ---\n" << contentB << "\n";
+        if (localDiff) {
+            prompt << changes.str();
+        } else {
+            prompt << "--- FILE A (" << fileA << ") ---\n" << contentA << "\n";
+            prompt << "\n--- FILE B (" << fileB << ") ---\n" << contentB << "\n";
+        }
 
         cout << "[AI] Analyzing changes (" << mode << ")..." << endl;
         string res = callAI(prompt.str());
         // For diff, we don't strict extract code blocks as the output IS the report (text)
-        string report = res;
-        try {
-            json j = json::parse(res);
-            if (j.contains("choices")) report = j["choices"][0]["message"]["content"];
-            else if (j.contains("candidates")) report = j["candidates"][0]["content"]["parts"][0]["text"];
-            else if (j.contains("response")) report = j["response"];
-        } catch(...) {}
+        string report = extractResponseText(res);
 
-        string outName = fs::path(fileA).stem().string() + "_" + fs::path(fileB).stem().string() + "_diff_report.md";
         ofstream out(outName);
         out << report;
         out.close();
@@ -1467,12 +5833,16 @@ int main(int argc, char* argv[]) {
         else if (arg == "-local") mode = "local";
         else if (arg == "-dry-run") dryRun = true;
         else if (arg == "-verbose") VERBOSE_MODE = true;
+        else if (arg == "--max-memory" && i+1 < argc) {
+            try { MAX_MEMORY_MB = stoul(argv[++i]); } catch (...) { cerr << "[ERROR] --max-memory expects a size in MB." << endl; return 1; }
+        }
         else if (arg == "-u" || arg == "--update") updateMode = true;
         else if (arg == "-run" || arg == "--run") runOutput = true;
         else if (arg == "-k" || arg == "--keep") keepSource = true;
         else if (arg == "-t" || arg == "--transpile") transpileMode = true;
         else if (arg == "-make") makeMode = true;
         else if (arg == "-series") seriesMode = true;
+        else if (arg == "-no-shake") TREE_SHAKE = false;
         else if (arg == "-3d") CURRENT_MODE = GenMode::MODEL_3D;
         else if (arg == "-img") CURRENT_MODE = GenMode::IMAGE;
         else if (arg == "-code") CURRENT_MODE = GenMode::CODE;
@@ -1576,13 +5946,23 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    // [NEW] Load the model in the background while we check toolchains and resolve inputs.
+    // When an earlier build may be reused as is, wait for the build cache check instead.
+    string cacheFile = ".yori_build.cache";
+    bool mayHitCache = !updateMode && fs::exists(cacheFile) && fs::exists(outputName);
+    if (!dryRun && !mayHitCache) startModelWarmUp(selectTier(0, 0));
+
+    // [NEW] Pipeline: the toolchain probe runs in the background while inputs are resolved;
+    // its result is reported right before the first compile needs it.
+    shared_future<ToolchainInfo> toolchainProbe;
     if (CURRENT_MODE == GenMode::CODE) {
         cout << "[CHECK] Toolchain for " << CURRENT_LANG.name << "..." << endl;
         if (CURRENT_LANG.versionCmd.empty()) {
             cout << "   [INFO] No toolchain required." << endl;
-        } else if (execCmd(CURRENT_LANG.versionCmd).exitCode != 0) {
-            cout << "   [!] Toolchain not found (" << CURRENT_LANG.versionCmd << "). Blind Mode." << endl;
-        } else cout << "   [OK] Ready." << endl;
+        } else {
+            toolchainProbe = async(launch::async, [cmd = CURRENT_LANG.versionCmd]() { return probeToolchain(cmd); }).share();
+            if (!dryRun) startCompileServer(CURRENT_LANG);
+        }
     } else if (CURRENT_MODE == GenMode::MODEL_3D) {
         cout << "[MODE] 3D Generation (" << CURRENT_LANG.name << ")" << endl;
     } else {
@@ -1593,12 +5973,22 @@ int main(int argc, char* argv[]) {
     vector<string> stack;
     
     // [FIX] Store processed files to export them only after validation
+    // [NEW] Kept as ranges into aggregatedContext instead of a second copy of every input
     struct InputData {
-        string content;
+        size_t offset, length;
         fs::path path;
     };
     vector<InputData> loadedInputs;
 
+    size_t inputBytes = 0;
+    for (const auto& file : inputFiles) {
+        std::error_code ec;
+        inputBytes += fs::file_size(file, ec);
+    }
+    if (!checkMemoryBudget(inputBytes, "Loading the inputs")) return 1;
+    aggregatedContext.reserve(inputBytes + inputFiles.size() * 128);
+
+    vector<string> resolvedInputs;
     for (const auto& file : inputFiles) {
         fs::path p(file);
         if (fs::exists(p)) {
@@ -1606,38 +5996,59 @@ int main(int argc, char* argv[]) {
             string raw((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
             
             string resolved = resolveImports(raw, p.parent_path(), stack);
+            raw.clear(); raw.shrink_to_fit();
             
             // [AUTO-DETECT] Enable makeMode if EXPORT is detected
             if (resolved.find("EXPORT:") != string::npos && !makeMode && !seriesMode) {
                 cout << "[INFO] 'EXPORT:' directive detected. Auto-enabling Architect Mode (-make)." << endl;
                 makeMode = true;
             }
-
-            // [MOVED] processExports call moved after validation
-            loadedInputs.push_back({resolved, p.parent_path()});
-
-            aggregatedContext += "\n// --- START FILE: " + file + " ---\n";
-            aggregatedContext += resolved;
-            aggregatedContext += "\n// --- END FILE: " + file + " ---\n";
+            resolvedInputs.push_back(move(resolved));
         } else {
             cerr << "Error: File not found: " << file << endl;
             return 1;
         }
     }
 
+    // [NEW] Keep only the parts of imported modules the inputs actually use
+    if (TREE_SHAKE) {
+        ShakeStats shake = treeShakeImports(resolvedInputs);
+        if (shake.dropped > 0) {
+            cout << "[SHAKE] Imports: dropped " << shake.dropped << " of " << shake.units << " definitions from " << shake.modules
+                 << " module(s), " << shake.bytesBefore / 1024 << " KB -> " << shake.bytesAfter / 1024 << " KB" << endl;
+        }
+    }
+
+    for (size_t i = 0; i < inputFiles.size(); i++) {
+        const string& file = inputFiles[i];
+        aggregatedContext += "\n// --- START FILE: " + file + " ---\n";
+        // [MOVED] processExports call moved after validation
+        loadedInputs.push_back({aggregatedContext.size(), resolvedInputs[i].size(), fs::path(file).parent_path()});
+        aggregatedContext += resolvedInputs[i];
+        aggregatedContext += "\n// --- END FILE: " + file + " ---\n";
+        string().swap(resolvedInputs[i]);
+    }
+
+    // Imports can grow the context well past the raw input size
+    if (!checkMemoryBudget(aggregatedContext.size(), "The resolved context")) return 1;
+
     // [NEW] Validate containers globally before processing
     if (!validateContainers(aggregatedContext)) return 1;
 
     // [FIX] Now it is safe to write initial exports (if any)
     for (const auto& data : loadedInputs) {
-        processExports(data.content, data.path);
+        if (string_view(aggregatedContext).substr(data.offset, data.length).find("EXPORT:") != string_view::npos) {
+            processExports(string_view(aggregatedContext).substr(data.offset, data.length), data.path);
+        }
     }
 
     // [NEW] Initialize Cache
     initCache();
 
-    size_t currentHash = hash<string>{}(aggregatedContext + CURRENT_LANG.id + MODEL_ID + (updateMode ? "u" : "n") + customInstructions);
-    string cacheFile = ".yori_build.cache"; 
+    // [NEW] The detected compiler version is part of the build identity (and of the prompt)
+    string toolchainVersion = (toolchainProbe.valid() && toolchainProbe.get().found) ? toolchainProbe.get().version : "";
+    size_t currentHash = hash<string_view>{}(aggregatedContext) ^
+                         (hash<string>{}(CURRENT_LANG.id + MODEL_ID + (updateMode ? "u" : "n") + customInstructions + toolchainVersion) * 31);
 
     if (!updateMode && !dryRun && fs::exists(cacheFile) && fs::exists(outputName)) {
         ifstream cFile(cacheFile);
@@ -1654,23 +6065,53 @@ int main(int argc, char* argv[]) {
             return 0;
         }
     }
+    if (!dryRun && mayHitCache) startModelWarmUp(selectTier(0, 0));
+
+    auto reportToolchain = [&]() {
+        if (!toolchainProbe.valid()) return;
+        const ToolchainInfo& tc = toolchainProbe.get();
+        if (!tc.found) {
+            cout << "   [!] Toolchain not found (" << CURRENT_LANG.versionCmd << "). Blind Mode." << endl;
+        } else cout << "   [OK] " << (tc.version.empty() ? "Toolchain ready" : tc.version) << (tc.cached ? " (cached)" : "") << endl;
+    };
 
+    // [NEW] The dependency probe compile runs concurrently with container processing and
+    // the first generation request; a failure cancels the in-flight request.
     set<string> potentialDeps = extractDependencies(aggregatedContext);
-    if (!preFlightCheck(potentialDeps)) return 1;
+    if (preFlightNeeded(potentialDeps)) cout << "[CHECK] Verifying dependencies locally..." << endl;
+    future<PreFlightResult> preflight = async(launch::async, [&potentialDeps]() { return runPreFlight(potentialDeps); });
+    atomic<bool> cancelFirstGen{false};
+    future<string> firstGen;
+    auto finishPreflight = [&]() -> bool {
+        PreFlightResult result = preflight.get();
+        if (result.ran && result.res.exitCode != 0 && firstGen.valid()) {
+            cancelFirstGen = true;
+            firstGen.wait();
+            log("INFO", "Preflight failed. Cancelled speculative generation.");
+        }
+        reportToolchain();
+        return reportPreFlight(potentialDeps, result);
+    };
 
     // [NEW] Process Containers (Cache Check & Injection)
     // If updateMode is true, we try to use cache.
-    aggregatedContext = processInputWithCache(aggregatedContext, updateMode, updateTargets);
+    if (aggregatedContext.find("$$") != string::npos) {
+        aggregatedContext = processInputWithCache(aggregatedContext, updateMode, updateTargets);
+    }
 
     // [SERIES MODE] Sequential Generation
     if (seriesMode) {
+        if (!finishPreflight()) return 1;
         cout << "[SERIES] Parsing blueprint for sequential generation..." << endl;
         auto blueprint = parseBlueprint(aggregatedContext);
         
         if (blueprint.empty()) {
             cout << "[WARN] No EXPORT blocks found for series mode." << endl;
         } else {
-            string projectContext = "";
+            // [NEW] Earlier files reach the prompt through the chunk index
+            vector<string> generatedFiles;
+            ChunkIndex chunkIndex;
+            chunkIndex.load();
             int currentItem = 0;
             int totalItems = blueprint.size();
             auto seriesStart = std::chrono::high_resolution_clock::now();
@@ -1679,34 +6120,34 @@ int main(int argc, char* argv[]) {
                 currentItem++;
                 cout << "   [" << currentItem << "/" << totalItems << "] Generating " << item.filename << "..." << endl;
                 
-                stringstream prompt;
+                string projectContext = retrieveContext(chunkIndex, generatedFiles, item.filename + "\n" + item.content);
+                // Rules first, then the project so far (which only grows while it is sent whole),
+                // then this file: consecutive files share the longest possible prefix
+                PromptBuffer prompt;
                 prompt << "ROLE: " << (CURRENT_MODE == GenMode::CODE ? "Software Architect" : "Asset Generator") << ".\n";
-                prompt << "TASK: Implement the file '" << item.filename << "'.\n";
-                prompt << "CONTEXT:\n" << projectContext << "\n";
-                prompt << "FILE INSTRUCTIONS:\n" << item.content << "\n";
                 prompt << "RULES:\n";
                 prompt << "1. Implement the full logic. No placeholders.\n";
                 prompt << "2. IMPORTANT: If you see '// YORI_BLOCK_START: id', IMPLEMENT the logic between it and '// YORI_BLOCK_END: id'. PRESERVE these markers exactly in the output so they can be cached.\n";
+                prompt.section(PromptBuffer::MODULES) << "CONTEXT:\n";
+                prompt.ref(projectContext) << "\n";
+                prompt.section(PromptBuffer::PASS) << "TASK: Implement the file '" << item.filename << "'.\n";
+                prompt << "FILE INSTRUCTIONS:\n" << item.content << "\n";
                 prompt << "OUTPUT: Return ONLY the valid code/content for " << item.filename << ". No markdown blocks if possible.";
                 
                 string code;
                 bool success = false;
                 int retries = 0;
 
+                // [NEW] Series files have no compile loop: route by prompt size only
+                int tier = selectTier(0, prompt.size());
                 while (retries < MAX_RETRIES) {
-                    string response = callAI(prompt.str());
+                    string response = callAI(prompt, tierOptions(tier));
                     code = extractCode(response);
                     
                     if (code.find("ERROR:") == 0) {
                         cout << "   [!] API Error (Attempt " << (retries + 1) << "/" << MAX_RETRIES << "): " << code.substr(6) << endl;
                         
-                        int waitTime = 5 * (retries + 1);
-                        if (code.find("Rate limit") != string::npos || code.find("429") != string::npos) {
-                            cout << "       -> Rate limit detected. Waiting " << waitTime << "s..." << endl;
-                        } else {
-                            cout << "       -> Retrying in " << waitTime << "s..." << endl;
-                        }
-                        std::this_thread::sleep_for(std::chrono::seconds(waitTime));
+                        backoffAfterApiError(code, retries);
                         retries++;
                     } else {
                         success = true;
@@ -1731,7 +6172,7 @@ int main(int argc, char* argv[]) {
                 long long eta = (long long)(avg * (totalItems - currentItem));
                 
                 cout << "      -> Saved. (ETA: " << formatDuration(eta) << ")" << endl;
-                projectContext += "\n// --- FILE: " + item.filename + " ---\n" + code + "\n";
+                if (find(generatedFiles.begin(), generatedFiles.end(), item.filename) == generatedFiles.end()) generatedFiles.push_back(item.filename);
             }
             cout << "[SERIES] All tasks completed." << endl;
             return 0;
@@ -1748,12 +6189,122 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    if (dryRun) { cout << "--- CONTEXT PREVIEW ---\n" << aggregatedContext << endl; return 0; }
+    if (dryRun) {
+        if (!finishPreflight()) return 1;
+        cout << "--- CONTEXT PREVIEW ---\n" << aggregatedContext << endl;
+        return 0;
+    }
 
     string tempSrc = "temp_build" + CURRENT_LANG.extension;
     string tempBin = "temp_build.exe"; 
     string errorHistory = ""; 
 
+    // [NEW] Make-mode repair state: files of the last full generation and the ones to redo
+    vector<string> projectFiles;
+    set<string> repairFiles;
+    ChunkIndex chunkIndex;
+    chunkIndex.load();
+
+    auto buildRepairPrompt = [&]() -> PromptBuffer {
+        PromptBuffer prompt;
+        string list;
+        for (const auto& f : repairFiles) list += (list.empty() ? "" : ", ") + f;
+        prompt << "ROLE: Software Architect.\n";
+        prompt << "TASK: The " << CURRENT_LANG.name << " project below fails to build. Fix ONLY the files listed under FIX.\n";
+        prompt << "RULES:\n";
+        prompt << "1. Return each file to fix in full, using 'EXPORT: \"filename\"' ... 'EXPORT: END'.\n";
+        prompt << "2. Do NOT output any other file. Files under READ-ONLY CONTEXT stay exactly as they are.\n";
+        prompt << "3. Keep the declarations other files rely on, unless the errors require changing them.\n";
+        prompt << "4. Output ONLY the EXPORT blocks. No conversation.\n";
+        if (!customInstructions.empty()) {
+            prompt.section(PromptBuffer::LANGUAGE) << "\n[USER INSTRUCTIONS - HIGHEST PRIORITY]:\n" << customInstructions << "\n";
+        }
+        prompt.section(PromptBuffer::PASS) << "\n--- BUILD ERRORS ---\n" << errorHistory << "\n";
+        prompt << "\nFIX: " << list << "\n";
+        auto readFile = [](const string& f) {
+            ifstream in(f, ios::binary);
+            return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        };
+        // [NEW] Read-only context: the chunks relevant to the errors and the files being fixed
+        string query = errorHistory;
+        prompt.section(PromptBuffer::HOST) << "\n--- FILES TO FIX ---\n";
+        for (const auto& f : repairFiles) {
+            string content = readFile(f);
+            prompt << "EXPORT: \"" << f << "\"\n" << content << "\nEXPORT: END\n";
+            query += "\n" + content;
+        }
+        vector<string> others;
+        for (const auto& f : projectFiles) if (!repairFiles.count(f)) others.push_back(f);
+        prompt.section(PromptBuffer::MODULES) << "\n--- READ-ONLY CONTEXT ---\n";
+        prompt << retrieveContext(chunkIndex, others, query);
+        prompt << "--- END CONTEXT ---\n";
+        return prompt;
+    };
+
+    auto buildPassPrompt = [&]() -> PromptBuffer {
+        PromptBuffer prompt;
+
+        if (CURRENT_MODE == GenMode::CODE) {
+            if (makeMode) {
+                prompt << "ROLE: Software Architect.\n";
+                prompt << "TASK: Structure and implement the project files for a " << CURRENT_LANG.name << " project.\n";
+                prompt << "RULES:\n";
+                prompt << "1. Use 'EXPORT: \"filename\"' ... 'EXPORT: END' for every file.\n";
+                prompt << "2. Implement full logic/content. No placeholders.\n";
+                prompt << "3. Include build scripts (Makefile/CMakeLists.txt) if needed.\n";
+                if (CURRENT_LANG.id == "cpp" || CURRENT_LANG.id == "c") {
+                    prompt << "4. NO wrappers (Python.h/system()). Native implementation only.\n";
+                }
+                prompt << "5. Process '$${ instructions }$$' templates by implementing the logic.\n";
+                prompt << "6. IMPORTANT: If you see '// YORI_BLOCK_START: id', IMPLEMENT the logic between it and '// YORI_BLOCK_END: id'. PRESERVE these markers exactly in the output so they can be cached.\n";
+                prompt << "6. Output ONLY the EXPORT blocks. No conversation.\n";
+            } else {
+                // [UPDATED v5.1] STRONGER ROLE DEFINITION AND GUARDRAILS
+                prompt << "ROLE: Semantic Transpiler.\n";
+                prompt << "TASK: Convert input logic to a single valid " << CURRENT_LANG.name << " file.\n";
+                prompt << "RULES:\n";
+                prompt << "1. NO wrappers (<Python.h>, system()). Re-implement logic natively.\n";
+                prompt << "2. Use standard libraries (e.g. std::vector, std::map).\n";
+                prompt << "3. Output must be self-contained and runnable.\n";
+                if (!CURRENT_LANG.buildCmd.empty()) {
+                    prompt << "4. Include a 'main' entry point.\n";
+                }
+                prompt << "5. IMPORTANT: If you see '// YORI_BLOCK_START: id', IMPLEMENT the logic between it and '// YORI_BLOCK_END: id'. PRESERVE these markers exactly in the output.\n";
+                prompt << "5. No external language headers.\n";
+            }
+            if (!toolchainVersion.empty()) prompt.section(PromptBuffer::LANGUAGE) << "TOOLCHAIN: " << toolchainVersion << " (use only features it supports)\n";
+        } else if (CURRENT_MODE == GenMode::MODEL_3D) {
+            prompt << "ROLE: Expert 3D Technical Artist & Modeler.\n";
+            prompt << "TASK: Generate a valid " << CURRENT_LANG.name << " file based on the description provided in the input files.\n";
+            prompt << "CONSTRAINTS: Ensure valid syntax for " << CURRENT_LANG.extension << ". Output ONLY the file content.\n";
+        } else {
+            prompt << "ROLE: Expert Vector Graphics Artist & Technical Illustrator.\n";
+            prompt << "TASK: Generate a valid " << CURRENT_LANG.name << " file based on the visual description.\n";
+            prompt << "CONSTRAINTS: Ensure valid syntax for " << CURRENT_LANG.extension << ". Output ONLY the file content (e.g. <svg>...</svg>).\n";
+        }
+
+        if (!customInstructions.empty()) {
+            prompt.section(PromptBuffer::LANGUAGE) << "\n[USER INSTRUCTIONS - HIGHEST PRIORITY]:\n" << customInstructions << "\n";
+        }
+
+        prompt.section(PromptBuffer::HOST);
+        if (updateMode && !existingCode.empty()) {
+            prompt << "TASK: UPDATE existing code.\n";
+            prompt << "\n--- [OLD CODE] ---\n";
+            prompt.ref(existingCode) << "\n--- [END OLD CODE] ---\n";
+            prompt << "\n--- [NEW INPUTS] ---\n";
+            prompt.ref(aggregatedContext) << "\n--- [END NEW INPUTS] ---\n";
+        } else {
+            prompt << "TASK: Create SINGLE " << CURRENT_LANG.name << " file.\n";
+            prompt << "\n--- INPUT SOURCES ---\n";
+            prompt.ref(aggregatedContext) << "\n--- END SOURCES ---\n";
+        }
+        prompt.section(PromptBuffer::PASS);
+        if (!errorHistory.empty()) prompt << "\n[!] PREVIOUS ERRORS:\n" << errorHistory << "\n";
+        prompt << "\nOUTPUT: Only code.";
+        return prompt;
+    };
+
     // [OPTIMIZATION] Direct Compilation for matching source files
     bool canDirectCompile = false;
     if (CURRENT_MODE == GenMode::CODE && CURRENT_LANG.producesBinary && 
@@ -1768,6 +6319,18 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // [NEW] Speculatively issue the first generation while preflight is still compiling
+    PromptBuffer firstPrompt;
+    AISession session; // [NEW] Ollama context carried from pass to pass
+    if (!canDirectCompile) {
+        firstPrompt = buildPassPrompt();
+        CallOptions opt = tierOptions(selectTier(0, firstPrompt.size()));
+        opt.cancel = &cancelFirstGen;
+        opt.session = &session;
+        firstGen = async(launch::async, [opt, &firstPrompt]() { return callAI(firstPrompt, opt); });
+    }
+    if (!finishPreflight()) return 1;
+
     if (canDirectCompile) {
         cout << "[DIRECT] Attempting direct compilation..." << endl;
         string fileList = "";
@@ -1777,7 +6340,10 @@ int main(int argc, char* argv[]) {
         string cmd = CURRENT_LANG.buildCmd + " " + fileList + " -o \"" + tempBin + "\"";
         if (VERBOSE_MODE) cout << "[CMD] " << cmd << endl;
         
+        FileLock slot;
+        acquireCompileSlot(slot);
         CmdResult build = execCmd(cmd);
+        slot.unlock();
         
         if (build.exitCode == 0) {
             cout << "[SUCCESS] Direct compilation succeeded." << endl;
@@ -1820,70 +6386,45 @@ int main(int argc, char* argv[]) {
     int passes = MAX_RETRIES;
     
     for(int gen=1; gen<=passes; gen++) {
-        if (makeMode) cout << "   [Pass " << gen << "] Architecting Project..." << endl;
-        else cout << "   [Pass " << gen << "] Generating " << CURRENT_LANG.name << "..." << endl;
-        
-        stringstream prompt;
-        
-        if (CURRENT_MODE == GenMode::CODE) {
-            if (makeMode) {
-                prompt << "ROLE: Software Architect.\n";
-                prompt << "TASK: Structure and implement the project files for a " << CURRENT_LANG.name << " project.\n";
-                prompt << "RULES:\n";
-                prompt << "1. Use 'EXPORT: \"filename\"' ... 'EXPORT: END' for every file.\n";
-                prompt << "2. Implement full logic/content. No placeholders.\n";
-                prompt << "3. Include build scripts (Makefile/CMakeLists.txt) if needed.\n";
-                if (CURRENT_LANG.id == "cpp" || CURRENT_LANG.id == "c") {
-                    prompt << "4. NO wrappers (Python.h/system()). Native implementation only.\n";
-                }
-                prompt << "5. Process '$${ instructions }$$' templates by implementing the logic.\n";
-                prompt << "6. IMPORTANT: If you see '// YORI_BLOCK_START: id', IMPLEMENT the logic between it and '// YORI_BLOCK_END: id'. PRESERVE these markers exactly in the output so they can be cached.\n";
-                prompt << "6. Output ONLY the EXPORT blocks. No conversation.\n";
-            } else {
-                // [UPDATED v5.1] STRONGER ROLE DEFINITION AND GUARDRAILS
-                prompt << "ROLE: Semantic Transpiler.\n";
-                prompt << "TASK: Convert input logic to a single valid " << CURRENT_LANG.name << " file.\n";
-                prompt << "RULES:\n";
-                prompt << "1. NO wrappers (<Python.h>, system()). Re-implement logic natively.\n";
-                prompt << "2. Use standard libraries (e.g. std::vector, std::map).\n";
-                prompt << "3. Output must be self-contained and runnable.\n";
-                if (!CURRENT_LANG.buildCmd.empty()) {
-                    prompt << "4. Include a 'main' entry point.\n";
-                }
-                prompt << "5. IMPORTANT: If you see '// YORI_BLOCK_START: id', IMPLEMENT the logic between it and '// YORI_BLOCK_END: id'. PRESERVE these markers exactly in the output.\n";
-                prompt << "5. No external language headers.\n";
-            }
-        } else if (CURRENT_MODE == GenMode::MODEL_3D) {
-            prompt << "ROLE: Expert 3D Technical Artist & Modeler.\n";
-            prompt << "TASK: Generate a valid " << CURRENT_LANG.name << " file based on the description provided in the input files.\n";
-            prompt << "CONSTRAINTS: Ensure valid syntax for " << CURRENT_LANG.extension << ". Output ONLY the file content.\n";
-        } else {
-            prompt << "ROLE: Expert Vector Graphics Artist & Technical Illustrator.\n";
-            prompt << "TASK: Generate a valid " << CURRENT_LANG.name << " file based on the visual description.\n";
-            prompt << "CONSTRAINTS: Ensure valid syntax for " << CURRENT_LANG.extension << ". Output ONLY the file content (e.g. <svg>...</svg>).\n";
+        if (makeMode && !repairFiles.empty()) {
+            cout << "   [Pass " << gen << "] Repairing " << repairFiles.size() << " file(s)..." << endl;
         }
+        else if (makeMode) cout << "   [Pass " << gen << "] Architecting Project..." << endl;
+        else cout << "   [Pass " << gen << "] Generating " << CURRENT_LANG.name << "..." << endl;
         
-        if (!customInstructions.empty()) {
-            prompt << "\n[USER INSTRUCTIONS - HIGHEST PRIORITY]:\n" << customInstructions << "\n";
-        }
-
-        if (updateMode && !existingCode.empty()) {
-            prompt << "TASK: UPDATE existing code.\n";
-            prompt << "\n--- [OLD CODE] ---\n" << existingCode << "\n--- [END OLD CODE] ---\n";
-            prompt << "\n--- [NEW INPUTS] ---\n" << aggregatedContext << "\n--- [END NEW INPUTS] ---\n";
-        } else {
-            prompt << "TASK: Create SINGLE " << CURRENT_LANG.name << " file.\n";
-            prompt << "\n--- INPUT SOURCES ---\n" << aggregatedContext << "\n--- END SOURCES ---\n";
-        }
-        if (!errorHistory.empty()) prompt << "\n[!] PREVIOUS ERRORS:\n" << errorHistory << "\n";
-        prompt << "\nOUTPUT: Only code.";
 
         string code;
         bool apiSuccess = false;
         int apiRetries = 0;
 
+        // [NEW] Model cascade: small model first, escalate when errors persist or the prompt is big
+        PromptBuffer promptText = !repairFiles.empty() ? buildRepairPrompt()
+                                : (gen == 1 && firstPrompt.size() > 0) ? firstPrompt : buildPassPrompt();
+        int tier = selectTier(gen - 1, promptText.size());
+        if (tier >= 0) cout << "   [CASCADE] Using " << CASCADE[tier].name << endl;
+        auto genStart = chrono::steady_clock::now();
+
+        // [NEW] Ollama session: when the model still holds the last pass, send only the errors
+        CallOptions passOpt = tierOptions(tier);
+        passOpt.session = &session;
+        if (gen > 1 && !errorHistory.empty()) {
+            if (!repairFiles.empty()) {
+                string list;
+                for (const auto& f : repairFiles) list += (list.empty() ? "" : ", ") + f;
+                passOpt.followUp = "Your last answer failed:\n" + errorHistory +
+                                   "\nFix ONLY these files: " + list + ". Return each of them in full, using 'EXPORT: \"filename\"' ... 'EXPORT: END'. Output ONLY the EXPORT blocks.";
+            } else if (makeMode) {
+                passOpt.followUp = "Your last answer failed:\n" + errorHistory +
+                                   "\nReturn the corrected project, every file in 'EXPORT: \"filename\"' ... 'EXPORT: END' blocks. Output ONLY the EXPORT blocks.";
+            } else {
+                passOpt.followUp = "Your last answer failed:\n" + errorHistory +
+                                   "\nReturn the complete corrected " + CURRENT_LANG.name + " file. OUTPUT: Only code.";
+            }
+        }
+
         while (apiRetries < MAX_RETRIES) {
-            string response = callAI(prompt.str());
+            // The first attempt of pass 1 was already issued during preflight
+            string response = firstGen.valid() ? firstGen.get() : callAI(promptText, passOpt);
             code = extractCode(response);
         
             if (code.find("ERROR:") == 0) { 
@@ -1893,13 +6434,7 @@ int main(int argc, char* argv[]) {
                      cout << "       (Hint: Check 'yori config cloud-protocol'. Current: " << PROTOCOL << ", Provider URL: " << API_URL << ")" << endl;
                 }
                 
-                int waitTime = 5 * (apiRetries + 1);
-                if (code.find("Rate limit") != string::npos || code.find("429") != string::npos) {
-                    cout << "       -> Rate limit detected. Waiting " << waitTime << "s..." << endl;
-                } else {
-                    cout << "       -> Retrying in " << waitTime << "s..." << endl;
-                }
-                std::this_thread::sleep_for(std::chrono::seconds(waitTime));
+                backoffAfterApiError(code, apiRetries);
                 apiRetries++;
             } else {
                 apiSuccess = true;
@@ -1911,37 +6446,57 @@ int main(int argc, char* argv[]) {
             cout << "   [FATAL] API failed after " << MAX_RETRIES << " attempts. Aborting." << endl;
             return 1;
         }
+        double genLatencyMs = chrono::duration<double, milli>(chrono::steady_clock::now() - genStart).count();
+
+        // [NEW] Reject structurally broken candidates without spending a compile
+        if (CURRENT_MODE == GenMode::CODE) {
+            string rejection = validateCandidate(code, CURRENT_LANG, makeMode);
+            if (!rejection.empty()) {
+                cout << "   [REJECT] " << rejection.substr(0, 200) << endl;
+                log("REJECT", "Pass " + to_string(gen) + ": " + rejection);
+                errorHistory = "--- Rejected Pass " + to_string(gen) + " (not compiled) ---\n" + rejection + "\n";
+                recordTierResult(tier, genLatencyMs, false);
+                continue;
+            }
+        }
 
         // [NEW] Update Cache from AI Output
         code = updateCacheFromOutput(code);
 
         // [MAKE 2.0] Process exports in AI output (Generate files dynamically)
-        code = processExports(code, fs::current_path());
+        if (makeMode && repairFiles.empty()) {
+            string ignored;
+            projectFiles.clear();
+            for (const auto& e : splitExports(code, fs::current_path(), ignored)) {
+                string f = fs::path(e.fname).lexically_normal().generic_string();
+                if (find(projectFiles.begin(), projectFiles.end(), f) == projectFiles.end()) projectFiles.push_back(f);
+            }
+        }
+        code = processExports(code, fs::current_path(), 0, repairFiles.empty() ? nullptr : &repairFiles);
 
         if (makeMode) {
             cout << "[MAKE] Generation complete. Files exported." << endl;
 
             // [INTELLIGENT BUILD] Auto-detect and run generated build scripts
-            bool buildSuccess = false;
-            if (fs::exists("Makefile")) {
-                cout << "[MAKE] Makefile detected. Executing 'make'..." << endl;
-                if (system("make") == 0) buildSuccess = true;
-            } else if (fs::exists("CMakeLists.txt")) {
-                cout << "[MAKE] CMakeLists.txt detected. Configuring and building..." << endl;
-                if (!fs::exists("build")) fs::create_directory("build");
-                if (system("cd build && cmake .. && cmake --build .") == 0) buildSuccess = true;
-            } else if (fs::exists("build.sh")) {
-                cout << "[MAKE] build.sh detected. Executing..." << endl;
-                #ifndef _WIN32
-                if (system("chmod +x build.sh && ./build.sh") == 0) buildSuccess = true;
-                #else
-                if (system("bash build.sh") == 0) buildSuccess = true;
-                #endif
-            } else if (fs::exists("build.bat")) {
-                cout << "[MAKE] build.bat detected. Executing..." << endl;
-                if (system("build.bat") == 0) buildSuccess = true;
-            } else {
-                cout << "[MAKE] No build script found. Skipping build step." << endl;
+            // [NEW] Incremental build driver; failures go back into the generation loop
+            BuildOutcome build = runProjectBuild();
+            bool buildSuccess = build.ok;
+            if (!build.hasBuildScript) cout << "[MAKE] No build script found. Skipping build step." << endl;
+            else recordTierResult(tier, genLatencyMs, buildSuccess);
+
+            if (build.hasBuildScript && !buildSuccess) {
+                string report = formatDiagnostics(build);
+                cout << "   [!] " << report.substr(0, 600) << (report.size() > 600 ? "..." : "") << endl;
+                log("FAIL", "Pass " + to_string(gen) + " build failed.");
+                errorHistory = "--- Build Error Pass " + to_string(gen) + " ---\n" + report;
+                // [NEW] Regenerate only the files the errors point at; anything else gets a full pass
+                repairFiles = filesToRepair(build, projectFiles);
+                if (!repairFiles.empty()) {
+                    string list;
+                    for (const auto& f : repairFiles) list += (list.empty() ? "" : ", ") + f;
+                    cout << "   [REPAIR] Next pass regenerates: " << list << endl;
+                }
+                continue;
             }
 
             if (runOutput) {
@@ -1971,6 +6526,7 @@ int main(int argc, char* argv[]) {
 
         if (CURRENT_MODE == GenMode::MODEL_3D || CURRENT_MODE == GenMode::IMAGE) {
             cout << "[SUCCESS] Asset generated: " << outputName << endl;
+            recordTierResult(tier, genLatencyMs, true);
             bool saved = false;
             for(int i=0; i<5; i++) {
                 try {
@@ -2002,13 +6558,12 @@ int main(int argc, char* argv[]) {
         if (CURRENT_LANG.buildCmd.empty()) {
             build.exitCode = 0;
         } else {
-            string valCmd = CURRENT_LANG.buildCmd + " \"" + tempSrc + "\"";
-            if (CURRENT_LANG.producesBinary) valCmd += " -o \"" + tempBin + "\""; 
-            build = execCmd(valCmd);
+            build = runVerifyBuild(CURRENT_LANG, tempSrc, tempBin);
         }
         
         if (build.exitCode == 0) {
             cout << "\nBUILD SUCCESSFUL: " << outputName << endl;
+            recordTierResult(tier, genLatencyMs, true);
             std::error_code ec;
             bool saveSuccess = false;
 
@@ -2072,6 +6627,7 @@ int main(int argc, char* argv[]) {
             string err = build.output;
             cout << "   [!] Error (Line " << gen << "): " << err.substr(0, 300) << "..." << endl;
             log("FAIL", "Pass " + to_string(gen) + " failed.");
+            recordTierResult(tier, genLatencyMs, false);
 
             // [UPDATED v5.1] Catch literal translation attempts
             if (err.find("python.h") != string::npos || err.find("Python.h") != string::npos) {